@@ -0,0 +1,134 @@
+// Measures the command to apply latency and jitter of the actuator thread,
+// posting commands at the rate of the web client to simulated servos. Then
+// checks that the failsafe brings the throttle back to neutral when the
+// commands stop.
+//
+// usage: actuator_bench [commands] [priority]
+
+#include "actuator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static uint64_t nowNs() {
+    return uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/// Drives for a while, stops posting and checks the outputs once the failsafe ramp is over
+/// @returns Number of failed checks
+static int checkFailsafe() {
+    ControlMailbox mailbox;
+    SimulatedServo steering;
+    SimulatedServo throttle;
+    ActuatorThread::Config config;
+    config.priority = 0;
+    ActuatorThread actuator(mailbox, steering, throttle, config);
+    actuator.start();
+
+    const int steeringValue = 1200;
+    for (int i = 0; i < 10; i++) {
+        mailbox.post(steeringValue, 2000);
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    int throttleBefore = throttle.pulseWidth();
+    auto before = actuator.stats();
+    // the ramp covers the full range of 1000 us in failsafeRamp
+    this_thread::sleep_for(config.failsafeTimeout + config.failsafeRamp + chrono::milliseconds(50));
+    auto after = actuator.stats();
+    actuator.stop();
+
+    int failures = 0;
+    auto check = [&failures](bool ok, const char *what) {
+        if (!ok) {
+            cerr << "failsafe: " << what << endl;
+            failures++;
+        }
+    };
+    check(throttleBefore == 2000, "throttle not applied before the failsafe");
+    check(before.failsafeEvents == 0 && !before.failsafeActive, "failsafe engaged while driving");
+    check(throttle.pulseWidth() == config.neutralThrottle, "throttle not back to neutral");
+    check(steering.pulseWidth() == steeringValue, "steering did not hold");
+    check(after.failsafeEvents == 1 && after.failsafeActive, "failsafe event not counted");
+    check(after.staleCommands > before.staleCommands, "stale commands not counted");
+    cout << "failsafe: throttle " << throttle.pulseWidth() << ", steering " << steering.pulseWidth() << ", "
+         << after.failsafeEvents << " events, " << after.staleCommands << " stale periods" << endl;
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    size_t commands = argc > 1 ? strtoul(argv[1], nullptr, 10) : 500;
+    int priority = argc > 2 ? atoi(argv[2]) : 0;
+
+    ControlMailbox mailbox;
+    SimulatedServo steering(1500, commands * 2);
+    SimulatedServo throttle(1500, commands * 2);
+
+    ActuatorThread::Config config;
+    // apply commands as they are, to measure the path and not the ramp
+    config.interpolation = chrono::milliseconds(0);
+    config.failsafeTimeout = chrono::milliseconds(1000);
+    config.priority = priority;
+    ActuatorThread actuator(mailbox, steering, throttle, config);
+    actuator.start();
+
+    const auto interval = chrono::milliseconds(20);
+    vector<uint64_t> posted;
+    posted.reserve(commands);
+    auto next = chrono::steady_clock::now();
+    for (size_t i = 0; i < commands; i++) {
+        next += interval;
+        this_thread::sleep_until(next);
+        // every command differs from the previous one, so each one is applied
+        posted.push_back(nowNs());
+        mailbox.post(1000 + int(i % 1000), 1500);
+    }
+    this_thread::sleep_for(chrono::milliseconds(50));
+    actuator.stop();
+
+    // match each command with the first sample applying its value
+    auto samples = steering.samples();
+    vector<double> latencies;
+    size_t s = 0;
+    for (size_t i = 0; i < posted.size(); i++) {
+        int value = 1000 + int(i % 1000);
+        while (s < samples.size() && (samples[s].time < posted[i] || samples[s].pulseWidth != value)) {
+            s++;
+        }
+        if (s == samples.size()) {
+            break;
+        }
+        latencies.push_back(double(samples[s].time - posted[i]) / 1000);
+    }
+    if (latencies.empty()) {
+        cerr << "No command was applied" << endl;
+        return 1;
+    }
+
+    sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for (double latency: latencies) {
+        mean += latency;
+    }
+    mean /= latencies.size();
+    double variance = 0;
+    for (double latency: latencies) {
+        variance += (latency - mean) * (latency - mean);
+    }
+    double jitter = sqrt(variance / latencies.size());
+
+    auto stats = actuator.stats();
+    cout << "period " << config.period.count() << " us, " << latencies.size() << "/" << commands
+         << " commands applied" << endl
+         << "latency us: mean " << mean << ", p50 " << latencies[latencies.size() / 2] << ", p99 "
+         << latencies[latencies.size() * 99 / 100] << ", max " << latencies.back() << endl
+         << "jitter (stddev) us: " << jitter << endl
+         << "missed periods: " << stats.missedDeadlines << endl;
+    return checkFailsafe() == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// Compares DispatchQueue with the previous mutex and std::function queue:
+// throughput and enqueue to start latency, with 1 to 4 worker and producer threads.
+//
+// usage: dispatch_bench [tasks_per_producer]
+
+#include "dispatchqueue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/// The queue DispatchQueue replaced
+class LegacyDispatchQueue {
+    typedef std::function<void(void)> fp_t;
+
+public:
+    LegacyDispatchQueue(size_t threadCount) : threads(threadCount) {
+        for (auto &thread: threads) {
+            thread = std::thread(&LegacyDispatchQueue::dispatchThreadHandler, this);
+        }
+    }
+
+    ~LegacyDispatchQueue() {
+        std::unique_lock<std::mutex> lock(lockMutex);
+        quit = true;
+        lock.unlock();
+        condition.notify_all();
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+
+    void dispatch(fp_t &&op) {
+        std::unique_lock<std::mutex> lock(lockMutex);
+        queue.push(std::move(op));
+        lock.unlock();
+        condition.notify_one();
+    }
+
+private:
+    std::mutex lockMutex;
+    std::vector<std::thread> threads;
+    std::queue<fp_t> queue;
+    std::condition_variable condition;
+    bool quit = false;
+
+    void dispatchThreadHandler() {
+        std::unique_lock<std::mutex> lock(lockMutex);
+        do {
+            condition.wait(lock, [this] { return (queue.size() || quit); });
+            if (!quit && queue.size()) {
+                auto op = std::move(queue.front());
+                queue.pop();
+                lock.unlock();
+                op();
+                lock.lock();
+            }
+        } while (!quit);
+    }
+};
+
+static int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Queue> static void run(const char *name, size_t threadCount, size_t tasksPerProducer) {
+    size_t total = threadCount * tasksPerProducer;
+    vector<int64_t> latencies(total);
+    atomic<size_t> done = 0;
+    int64_t start, end;
+    {
+        Queue queue(threadCount);
+        vector<thread> producers;
+        start = nowNs();
+        for (size_t p = 0; p < threadCount; p++) {
+            producers.emplace_back([&, p]() {
+                for (size_t i = 0; i < tasksPerProducer; i++) {
+                    // a typical capture: a pointer, an index and a timestamp
+                    int64_t *slot = &latencies[p * tasksPerProducer + i];
+                    int64_t posted = nowNs();
+                    queue.dispatch([slot, posted, &done]() {
+                        *slot = nowNs() - posted;
+                        done.fetch_add(1, memory_order_release);
+                    });
+                }
+            });
+        }
+        for (auto &producer: producers) {
+            producer.join();
+        }
+        while (done.load(memory_order_acquire) < total) {
+            this_thread::yield();
+        }
+        end = nowNs();
+    }
+    sort(latencies.begin(), latencies.end());
+    cout << name << " threads " << threadCount << ": " << uint64_t(double(total) * 1e9 / double(end - start))
+         << " ops/s, latency us p50 " << latencies[total / 2] / 1000.0 << ", p99 "
+         << latencies[total * 99 / 100] / 1000.0 << ", p99.9 " << latencies[total * 999 / 1000] / 1000.0 << endl;
+}
+
+struct LockFreeQueue : DispatchQueue {
+    LockFreeQueue(size_t threadCount) : DispatchQueue("bench", threadCount) {}
+};
+
+int main(int argc, char **argv) {
+    size_t tasksPerProducer = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    for (size_t threadCount = 1; threadCount <= 4; threadCount++) {
+        run<LegacyDispatchQueue>("mutex    ", threadCount, tasksPerProducer);
+        run<LockFreeQueue>("lock-free", threadCount, tasksPerProducer);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Compares the messagecodec scanner with nlohmann::json DOM parsing on the
+// messages the server receives.
+//
+// usage: json_bench [iterations]
+
+#include "messagecodec.hpp"
+#include "nlohmann/json.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static const string controlMessage = R"({"x":1555,"y":1500})";
+static const string candidateMessage =
+    R"({"id":"Xk3pQ0aZ7b","type":"candidate","candidate":"candidate:842163049 1 udp 1677729535 203.0.113.7 54321 typ srflx raddr 0.0.0.0 rport 0 generation 0 ufrag 4ZcD network-cost 999","mid":"0"})";
+
+// keeps the optimizer from dropping the parse
+static volatile int64_t sink = 0;
+
+template <typename F> static void measure(const char *name, size_t iterations, F parse) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        sink = sink + parse();
+    }
+    auto elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    cout << name << ": " << elapsed / iterations << " ns/message" << endl;
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+    measure("control  nlohmann", iterations, []() {
+        auto message = nlohmann::json::parse(controlMessage);
+        return message["x"].get<int>() + message["y"].get<int>();
+    });
+    measure("control  scanner ", iterations, []() {
+        ControlMessage message;
+        parseControlMessage(controlMessage, message);
+        return message.x.value_or(0) + message.y.value_or(0);
+    });
+    measure("candidate nlohmann", iterations, []() {
+        auto message = nlohmann::json::parse(candidateMessage);
+        return int64_t(message["candidate"].get<string>().size() + message["mid"].get<string>().size());
+    });
+    measure("candidate scanner ", iterations, []() {
+        SignalingMessage message;
+        parseSignalingMessage(candidateMessage, message);
+        return int64_t(message.candidate.value_or("").size() + message.mid.value_or("").size());
+    });
+    return 0;
+}
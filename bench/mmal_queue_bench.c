@@ -0,0 +1,273 @@
+// Stress test and benchmark of MMAL_QUEUE_T, built once with the mutex queue
+// (mmal_queue_bench_mutex) and once with MMAL_QUEUE_LOCKFREE (mmal_queue_bench).
+//
+// Producers take buffers from a free queue, stamp them and put them on a work
+// queue; one consumer checks them and returns them to the free queue, like a
+// port and its pool. The batched run does the same with mmal_queue_get_n() and
+// mmal_queue_put_n(). Then a paced producer measures how long a put takes to
+// wake a consumer blocked in mmal_queue_wait().
+//
+// usage: mmal_queue_bench [buffers_per_producer]
+
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/mmal_queue.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PRODUCERS 3
+#define BUFFERS_PER_PRODUCER 16
+#define LATENCY_SAMPLES 20000
+#define BATCH_SIZE 8
+
+#ifdef MMAL_QUEUE_LOCKFREE
+static const char *variant = "lock-free";
+#else
+static const char *variant = "mutex    ";
+#endif
+
+typedef struct
+{
+   MMAL_QUEUE_T *free;
+   MMAL_QUEUE_T *work;
+   unsigned int index;
+   unsigned int count;
+   int batch;
+} PRODUCER_T;
+
+static int64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *producer_thread(void *arg)
+{
+   PRODUCER_T *producer = arg;
+   MMAL_BUFFER_HEADER_T *batch[BATCH_SIZE];
+   unsigned int i = 1, n, j;
+
+   while (i <= producer->count)
+   {
+      if (producer->batch)
+      {
+         n = mmal_queue_get_n(producer->free, batch, vcos_min(BATCH_SIZE, producer->count - i + 1));
+         if (!n)
+            batch[n++] = mmal_queue_wait(producer->free);
+      }
+      else
+      {
+         batch[0] = mmal_queue_wait(producer->free);
+         n = 1;
+      }
+      for (j = 0; j < n; j++)
+      {
+         batch[j]->user_data = (void *)(uintptr_t)producer->index;
+         batch[j]->pts = i++;
+      }
+      if (producer->batch)
+         mmal_queue_put_n(producer->work, batch, n);
+      else
+         mmal_queue_put(producer->work, batch[0]);
+   }
+   return NULL;
+}
+
+/** Checks a buffer received from the producers, returns the number of errors */
+static int check_buffer(MMAL_BUFFER_HEADER_T *buffer, unsigned int producer_count, int64_t *last)
+{
+   unsigned int index = (unsigned int)(uintptr_t)buffer->user_data;
+
+   if (index >= producer_count || buffer->pts != last[index] + 1)
+   {
+      fprintf(stderr, "producer %u: got %lld after %lld\n", index, (long long)buffer->pts,
+              index < producer_count ? (long long)last[index] : -1LL);
+      return 1;
+   }
+   last[index] = buffer->pts;
+   return 0;
+}
+
+/** Runs the producers against one consumer, returns the number of errors */
+static int run_stress(unsigned int producer_count, unsigned int count, int batch, double *rate)
+{
+   MMAL_BUFFER_HEADER_T buffers[MAX_PRODUCERS][BUFFERS_PER_PRODUCER];
+   PRODUCER_T producers[MAX_PRODUCERS];
+   pthread_t threads[MAX_PRODUCERS];
+   int64_t last[MAX_PRODUCERS] = {0};
+   MMAL_QUEUE_T *work = mmal_queue_create();
+   unsigned int received = 0, total = producer_count * count, i, j;
+   int errors = 0;
+   int64_t start;
+
+   memset(buffers, 0, sizeof(buffers));
+   for (i = 0; i < producer_count; i++)
+   {
+      producers[i].free = mmal_queue_create();
+      producers[i].work = work;
+      producers[i].index = i;
+      producers[i].count = count;
+      producers[i].batch = batch;
+      for (j = 0; j < BUFFERS_PER_PRODUCER; j++)
+         mmal_queue_put(producers[i].free, &buffers[i][j]);
+   }
+
+   start = now_ns();
+   for (i = 0; i < producer_count; i++)
+      pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+
+   while (batch && received < total)
+   {
+      MMAL_BUFFER_HEADER_T *buffers[BATCH_SIZE * 2];
+      unsigned int n = mmal_queue_get_n(work, buffers, BATCH_SIZE * 2), first, index;
+
+      if (!n)
+         buffers[n++] = mmal_queue_wait(work);
+      for (i = 0; i < n; i++)
+         errors += check_buffer(buffers[i], producer_count, last);
+      received += n;
+
+      // hand back runs of buffers from the same producer in one go
+      for (first = 0; first < n; first = i)
+      {
+         index = (unsigned int)(uintptr_t)buffers[first]->user_data;
+         for (i = first + 1; i < n && (uintptr_t)buffers[i]->user_data == index; i++)
+            ;
+         mmal_queue_put_n(producers[index % producer_count].free, buffers + first, i - first);
+      }
+   }
+
+   while (!batch && received < total)
+   {
+      MMAL_BUFFER_HEADER_T *buffer;
+      unsigned int index;
+
+      // exercise every way of getting a buffer
+      switch (received % 4)
+      {
+      case 0: buffer = mmal_queue_get(work); break;
+      case 1: buffer = mmal_queue_timedwait(work, 100); break;
+      case 2:
+         buffer = mmal_queue_wait(work);
+         mmal_queue_put_back(work, buffer);
+         if (mmal_queue_get(work) != buffer)
+         {
+            fprintf(stderr, "put back buffer is not the next one\n");
+            errors++;
+         }
+         break;
+      default: buffer = mmal_queue_wait(work); break;
+      }
+      if (!buffer)
+         continue;
+
+      errors += check_buffer(buffer, producer_count, last);
+      index = (unsigned int)(uintptr_t)buffer->user_data;
+      received++;
+      mmal_queue_put(producers[index % producer_count].free, buffer);
+   }
+   *rate = total * 1e9 / (double)(now_ns() - start);
+
+   for (i = 0; i < producer_count; i++)
+   {
+      pthread_join(threads[i], NULL);
+      if (mmal_queue_length(producers[i].free) != BUFFERS_PER_PRODUCER)
+      {
+         fprintf(stderr, "producer %u: %u free buffers\n", i, mmal_queue_length(producers[i].free));
+         errors++;
+      }
+      mmal_queue_destroy(producers[i].free);
+   }
+   if (mmal_queue_length(work) != 0 || mmal_queue_get(work) != NULL)
+   {
+      fprintf(stderr, "work queue not empty\n");
+      errors++;
+   }
+   if (mmal_queue_timedwait(work, 10) != NULL)
+   {
+      fprintf(stderr, "timed wait on an empty queue returned a buffer\n");
+      errors++;
+   }
+   mmal_queue_destroy(work);
+   return errors;
+}
+
+typedef struct
+{
+   MMAL_QUEUE_T *queue;
+   int64_t latencies[LATENCY_SAMPLES];
+} LATENCY_T;
+
+static void *waiter_thread(void *arg)
+{
+   LATENCY_T *latency = arg;
+   unsigned int i;
+
+   for (i = 0; i < LATENCY_SAMPLES; i++)
+   {
+      MMAL_BUFFER_HEADER_T *buffer = mmal_queue_wait(latency->queue);
+      latency->latencies[i] = now_ns() - buffer->dts;
+   }
+   return NULL;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+   return x < y ? -1 : x > y;
+}
+
+static void run_latency(void)
+{
+   static LATENCY_T latency;
+   static MMAL_BUFFER_HEADER_T buffers[LATENCY_SAMPLES];
+   struct timespec pause = {0, 50000};
+   pthread_t thread;
+   unsigned int i;
+
+   latency.queue = mmal_queue_create();
+   pthread_create(&thread, NULL, waiter_thread, &latency);
+   for (i = 0; i < LATENCY_SAMPLES; i++)
+   {
+      // let the consumer go back to sleep
+      nanosleep(&pause, NULL);
+      buffers[i].dts = now_ns();
+      mmal_queue_put(latency.queue, &buffers[i]);
+   }
+   pthread_join(thread, NULL);
+   mmal_queue_destroy(latency.queue);
+
+   qsort(latency.latencies, LATENCY_SAMPLES, sizeof(int64_t), compare_int64);
+   printf("%s wake latency us: p50 %.1f, p99 %.1f, p99.9 %.1f\n", variant,
+          latency.latencies[LATENCY_SAMPLES / 2] / 1000.0,
+          latency.latencies[LATENCY_SAMPLES * 99 / 100] / 1000.0,
+          latency.latencies[LATENCY_SAMPLES * 999 / 1000] / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int count = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 10) : 200000;
+   unsigned int producers;
+   int errors = 0, batch;
+
+   for (batch = 0; batch <= 1; batch++)
+      for (producers = 1; producers <= MAX_PRODUCERS; producers++)
+      {
+         double rate;
+         errors += run_stress(producers, count, batch, &rate);
+         printf("%s producers %u%s: %.0f buffers/s\n", variant, producers, batch ? ", batched" : "", rate);
+      }
+   run_latency();
+
+   if (errors)
+   {
+      printf("%d errors\n", errors);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,109 @@
+// Measures srtp_protect() throughput of the SRTP profiles libdatachannel can
+// negotiate, using the libsrtp linked into libdatachannel.
+//
+// usage: srtp_bench [seconds_per_run]
+
+#include <srtp.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+struct Profile {
+    const char *name;
+    void (*setPolicy)(srtp_crypto_policy_t *policy);
+};
+
+static const Profile profiles[] = {
+    {"SRTP_AES128_CM_SHA1_80", srtp_crypto_policy_set_rtp_default},
+    {"SRTP_AEAD_AES_128_GCM", srtp_crypto_policy_set_aes_gcm_128_16_auth},
+    {"SRTP_AEAD_AES_256_GCM", srtp_crypto_policy_set_aes_gcm_256_16_auth},
+};
+
+/// Audio frame and full video packet
+static const size_t payloadSizes[] = {160, 1200};
+static const size_t rtpHeaderSize = 12;
+
+/// Protects packets for the given duration
+/// @returns Packets per second, 0 if the profile is not available
+static double run(const Profile &profile, size_t payloadSize, double seconds) {
+    uint8_t key[64];
+    mt19937 rng(42);
+    for (auto &byte: key) {
+        byte = uint8_t(rng());
+    }
+
+    srtp_policy_t policy;
+    memset(&policy, 0, sizeof(policy));
+    profile.setPolicy(&policy.rtp);
+    profile.setPolicy(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = key;
+    policy.window_size = 1024;
+    policy.allow_repeat_tx = 1;
+
+    srtp_t session;
+    if (srtp_create(&session, &policy) != srtp_err_status_ok) {
+        return 0;
+    }
+
+    vector<uint8_t> packet(rtpHeaderSize + payloadSize + SRTP_MAX_TRAILER_LEN);
+    vector<uint8_t> plain(rtpHeaderSize + payloadSize);
+    plain[0] = 0x80;
+    plain[1] = 102;
+    plain[8] = 0x12;
+    for (size_t i = rtpHeaderSize; i < plain.size(); i++) {
+        plain[i] = uint8_t(rng());
+    }
+
+    uint64_t count = 0;
+    uint16_t seqNo = 0;
+    auto start = chrono::steady_clock::now();
+    auto end = start + chrono::duration<double>(seconds);
+    auto now = start;
+    while (now < end) {
+        // check the clock every 256 packets
+        for (int i = 0; i < 256; i++) {
+            memcpy(packet.data(), plain.data(), plain.size());
+            packet[2] = uint8_t(seqNo >> 8);
+            packet[3] = uint8_t(seqNo);
+            seqNo++;
+            int length = int(plain.size());
+            if (srtp_protect(session, packet.data(), &length) != srtp_err_status_ok) {
+                srtp_dealloc(session);
+                return 0;
+            }
+        }
+        count += 256;
+        now = chrono::steady_clock::now();
+    }
+    srtp_dealloc(session);
+    return double(count) / chrono::duration<double>(now - start).count();
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    if (srtp_init() != srtp_err_status_ok) {
+        cerr << "srtp_init failed" << endl;
+        return 1;
+    }
+    for (auto &profile: profiles) {
+        for (auto payloadSize: payloadSizes) {
+            double rate = run(profile, payloadSize, seconds);
+            if (rate == 0) {
+                cout << profile.name << " not available" << endl;
+                break;
+            }
+            cout << profile.name << " payload " << payloadSize << " B: " << uint64_t(rate) << " packets/s, "
+                 << rate * payloadSize * 8 / 1e6 << " Mbit/s" << endl;
+        }
+    }
+    srtp_shutdown();
+    return 0;
+}
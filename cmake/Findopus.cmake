@@ -0,0 +1,26 @@
+################################################################################
+### Find the opus shared libraries.
+################################################################################
+
+# Find the path to the opus includes.
+find_path(opus_INCLUDE_DIR
+	NAMES opus.h
+	PATH_SUFFIXES opus
+	HINTS /usr/local/include)
+
+# Find the opus library.
+find_library(opus_LIBRARY
+	NAMES libopus.so
+	HINTS /usr/local/lib)
+
+# Set the opus variables to plural form to make them accessible for
+# the paramount cmake modules.
+set(opus_INCLUDE_DIRS ${opus_INCLUDE_DIR})
+set(opus_INCLUDES     ${opus_INCLUDE_DIR})
+
+# Handle REQUIRED, QUIET, and version arguments
+# and set the <packagename>_FOUND variable.
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(opus
+    DEFAULT_MSG
+    opus_INCLUDE_DIR opus_LIBRARY)
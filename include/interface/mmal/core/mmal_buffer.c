@@ -38,9 +38,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T *header)
 {
 #ifdef ENABLE_MMAL_EXTRA_LOGGING
-   LOG_TRACE("%p (%i)", header, (int)header->priv->refcount+1);
+   LOG_TRACE("%p (%i)", header, (int)__atomic_load_n(&header->priv->refcount, __ATOMIC_RELAXED)+1);
 #endif
-   header->priv->refcount++;
+   /* The caller already holds a reference, so there is nothing to order against */
+   __atomic_fetch_add(&header->priv->refcount, 1, __ATOMIC_RELAXED);
 }
 
 /** Reset a buffer header */
@@ -57,10 +58,13 @@ void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T *header)
 void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T *header)
 {
 #ifdef ENABLE_MMAL_EXTRA_LOGGING
-   LOG_TRACE("%p (%i)", header, (int)header->priv->refcount-1);
+   LOG_TRACE("%p (%i)", header, (int)__atomic_load_n(&header->priv->refcount, __ATOMIC_RELAXED)-1);
 #endif
 
-   if(--header->priv->refcount != 0)
+   /* Buffer headers are shared between threads, e.g. one encoder output sent
+    * to several peers. Each release publishes that thread's use of the buffer,
+    * and the last one acquires all of them before the buffer is recycled. */
+   if(__atomic_sub_fetch(&header->priv->refcount, 1, __ATOMIC_ACQ_REL) != 0)
       return;
 
    if (header->priv->pf_pre_release)
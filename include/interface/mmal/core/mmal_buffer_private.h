@@ -65,6 +65,9 @@ typedef struct MMAL_BUFFER_HEADER_PRIVATE_T
 
    uint8_t driver_area[MMAL_DRIVER_BUFFER_SIZE];
 
+   uint32_t send_time;        /**< Time (us) the buffer header was last sent to a port, for
+                                   the port's latency histogram */
+
 } MMAL_BUFFER_HEADER_PRIVATE_T;
 
 /** Get the size in bytes of a fully initialised MMAL_BUFFER_HEADER_T */
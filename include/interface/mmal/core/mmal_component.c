@@ -25,6 +25,9 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for pthread_setaffinity_np() */
+#endif
 #include "mmal.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
@@ -49,6 +52,10 @@ typedef struct
    VCOS_EVENT_T action_event;
    VCOS_MUTEX_T action_mutex;
    MMAL_BOOL_T action_quit;
+   /** Scheduling of the action thread, see \ref mmal_component_action_scheduling_set */
+   int action_policy;
+   int action_priority;
+   uint32_t action_cpus;
 
    VCOS_MUTEX_T lock; /**< Used to lock access to the component */
    MMAL_BOOL_T destruction_pending;
@@ -544,6 +551,39 @@ MMAL_STATUS_T mmal_port_release(MMAL_PORT_T *port)
  * Actions support
  *****************************************************************************/
 
+/** Applies the scheduling policy, priority and CPUs of the component to its action thread */
+static MMAL_STATUS_T mmal_component_action_apply_scheduling(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_CORE_PRIVATE_T *private = (MMAL_COMPONENT_CORE_PRIVATE_T *)component->priv;
+   pthread_t thread = private->action_thread.thread;
+   struct sched_param param;
+   cpu_set_t cpus;
+   unsigned int cpu;
+   int rc;
+
+   param.sched_priority = private->action_policy == SCHED_OTHER ? 0 : private->action_priority;
+   rc = pthread_setschedparam(thread, private->action_policy, &param);
+   if (rc)
+   {
+      LOG_ERROR("%s: cannot set scheduling policy %i priority %i (%i)", component->name,
+                private->action_policy, private->action_priority, rc);
+      return rc == EPERM ? MMAL_ENOSPC : MMAL_EINVAL;
+   }
+
+   /* No CPUs given means all of them */
+   CPU_ZERO(&cpus);
+   for (cpu = 0; cpu < 32; cpu++)
+      if (!private->action_cpus || (private->action_cpus & (1u << cpu)))
+         CPU_SET(cpu, &cpus);
+   rc = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+   if (rc)
+   {
+      LOG_ERROR("%s: cannot set CPUs 0x%x (%i)", component->name, private->action_cpus, rc);
+      return MMAL_EINVAL;
+   }
+   return MMAL_SUCCESS;
+}
+
 /** Registers an action with the core */
 static void *mmal_component_action_thread_func(void *arg)
 {
@@ -594,6 +634,8 @@ MMAL_STATUS_T mmal_component_action_register(MMAL_COMPONENT_T *component,
    vcos_thread_attr_init(&attrs);
    vcos_thread_attr_setpriority(&attrs,
                                 private->private.priority);
+   vcos_thread_attr_setscheduling(&attrs, private->action_policy, private->action_priority);
+   vcos_thread_attr_setcpus(&attrs, private->action_cpus);
    status = vcos_thread_create(&private->action_thread, component->name, &attrs,
                                mmal_component_action_thread_func, component);
    if (status != VCOS_SUCCESS)
@@ -603,6 +645,10 @@ MMAL_STATUS_T mmal_component_action_register(MMAL_COMPONENT_T *component,
       return MMAL_ENOMEM;
    }
 
+   /* The system libvcos predates the scheduling attributes and ignores them */
+   if (private->action_policy != SCHED_OTHER || private->action_cpus)
+      mmal_component_action_apply_scheduling(component);
+
    private->pf_action = pf_action;
    return MMAL_SUCCESS;
 }
@@ -637,6 +683,30 @@ MMAL_STATUS_T mmal_component_action_trigger(MMAL_COMPONENT_T *component)
    return MMAL_SUCCESS;
 }
 
+/** Sets the scheduling of the action thread */
+MMAL_STATUS_T mmal_component_action_scheduling_set(MMAL_COMPONENT_T *component,
+   int policy, int priority, uint32_t cpus)
+{
+   MMAL_COMPONENT_CORE_PRIVATE_T *private;
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+
+   if (!component)
+      return MMAL_EINVAL;
+   if (policy != SCHED_OTHER && (priority < sched_get_priority_min(policy) ||
+                                 priority > sched_get_priority_max(policy)))
+      return MMAL_EINVAL;
+
+   private = (MMAL_COMPONENT_CORE_PRIVATE_T *)component->priv;
+   vcos_mutex_lock(&private->lock);
+   private->action_policy = policy;
+   private->action_priority = priority;
+   private->action_cpus = cpus;
+   if (private->pf_action)
+      status = mmal_component_action_apply_scheduling(component);
+   vcos_mutex_unlock(&private->lock);
+   return status;
+}
+
 /** Lock an action to prevent it from running */
 MMAL_STATUS_T mmal_component_action_lock(MMAL_COMPONENT_T *component)
 {
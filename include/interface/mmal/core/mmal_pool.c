@@ -30,6 +30,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "core/mmal_buffer_private.h"
 #include "mmal_logging.h"
 
+#ifdef MMAL_POOL_CONTIGUOUS
+#include <sys/mman.h>
+
+/** Contiguous memory region the payloads of a pool are carved from */
+typedef struct MMAL_POOL_REGION_T
+{
+   uint8_t *base;     /**< Start of the mapping, huge page aligned when large enough */
+   size_t size;       /**< Size of the mapping */
+   size_t used;       /**< Bytes handed out as payloads */
+   unsigned int live; /**< Payloads handed out and not freed yet */
+} MMAL_POOL_REGION_T;
+#endif
+
 /** Definition of a pool */
 typedef struct MMAL_POOL_PRIVATE_T
 {
@@ -47,11 +60,22 @@ typedef struct MMAL_POOL_PRIVATE_T
 
    unsigned int headers_alloc_num; /**< Number of buffer headers allocated as part of the private structure */
 
+#ifdef MMAL_POOL_CONTIGUOUS
+   MMAL_POOL_REGION_T region; /**< Payload memory when using the default allocator */
+#endif
+
 } MMAL_POOL_PRIVATE_T;
 
 #define ROUND_UP(s,align) ((((unsigned long)(s)) & ~((align)-1)) + (align))
 #define ALIGN  8
 
+/** Buffer headers each start on their own cache line, so that threads handing
+ * buffers to each other don't also share the lines of neighbouring headers */
+#define CACHE_LINE 64
+#define ALIGN_UP(s,align) ((((unsigned long)(s)) + (align) - 1) & ~((unsigned long)(align) - 1))
+/** Offset of the first buffer header from pool->header, after the array of pointers */
+#define HEADERS_OFFSET(headers) ALIGN_UP(sizeof(void *)*(headers), CACHE_LINE)
+
 static void mmal_pool_buffer_header_release(MMAL_BUFFER_HEADER_T *header);
 
 static void *mmal_pool_allocator_default_alloc(void *context, uint32_t size)
@@ -66,6 +90,93 @@ static void mmal_pool_allocator_default_free(void *context, void *mem)
    vcos_free(mem);
 }
 
+#ifdef MMAL_POOL_CONTIGUOUS
+#define HUGE_PAGE_SIZE (2 << 20)
+
+static void mmal_pool_region_unmap(MMAL_POOL_REGION_T *region)
+{
+   if (region->base)
+      munmap(region->base, region->size);
+   region->base = NULL;
+   region->size = region->used = 0;
+}
+
+/** Map a region large enough for the given payloads, replacing the current one.
+ * Regions of a huge page or more are aligned to huge pages and advised to use them. */
+static MMAL_STATUS_T mmal_pool_region_map(MMAL_POOL_REGION_T *region, unsigned int payloads,
+                                          uint32_t payload_size)
+{
+   size_t size = (size_t)payloads * ALIGN_UP(payload_size, CACHE_LINE);
+   size_t align = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+   size_t mapping_size;
+   uint8_t *mapping, *base;
+
+   vcos_assert(!region->live);
+   mmal_pool_region_unmap(region);
+   if (!size)
+      return MMAL_SUCCESS;
+
+   if (align)
+      size = ALIGN_UP(size, align);
+   mapping_size = size + align;
+   mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (mapping == MAP_FAILED)
+   {
+      LOG_ERROR("failed to map %u bytes for payloads", (unsigned int)mapping_size);
+      return MMAL_ENOMEM;
+   }
+
+   /* Give back the slack on each side of the aligned part */
+   base = (uint8_t *)(align ? ALIGN_UP(mapping, align) : (unsigned long)mapping);
+   if (base != mapping)
+      munmap(mapping, base - mapping);
+   if (base + size != mapping + mapping_size)
+      munmap(base + size, mapping + mapping_size - (base + size));
+#ifdef MADV_HUGEPAGE
+   if (align && madvise(base, size, MADV_HUGEPAGE))
+      LOG_DEBUG("no transparent huge pages for payloads");
+#endif
+
+   LOG_TRACE("mapped %u bytes for %u payloads at %p", (unsigned int)size, payloads, base);
+   region->base = base;
+   region->size = size;
+   return MMAL_SUCCESS;
+}
+
+/** Carve the next cache line aligned payload from the region.
+ * Freed payloads are only reused once all of them are freed, which is what
+ * mmal_pool_resize() does. */
+static void *mmal_pool_region_alloc(void *context, uint32_t size)
+{
+   MMAL_POOL_REGION_T *region = (MMAL_POOL_REGION_T *)context;
+   size_t slot = ALIGN_UP(size, CACHE_LINE);
+   uint8_t *payload;
+
+   if (!region->live)
+      region->used = 0;
+   if (region->size - region->used < slot)
+   {
+      LOG_ERROR("payload region full (%u/%u bytes used)", (unsigned int)region->used,
+                (unsigned int)region->size);
+      return NULL;
+   }
+
+   payload = region->base + region->used;
+   region->used += slot;
+   region->live++;
+   return payload;
+}
+
+static void mmal_pool_region_free(void *context, void *mem)
+{
+   MMAL_POOL_REGION_T *region = (MMAL_POOL_REGION_T *)context;
+
+   vcos_assert((uint8_t *)mem >= region->base && (uint8_t *)mem < region->base + region->size);
+   MMAL_PARAM_UNUSED(mem);
+   region->live--;
+}
+#endif /* MMAL_POOL_CONTIGUOUS */
+
 static MMAL_STATUS_T mmal_pool_initialise_buffer_headers(MMAL_POOL_T *pool, unsigned int headers,
                                                          MMAL_BOOL_T reinitialise)
 {
@@ -74,7 +185,7 @@ static MMAL_STATUS_T mmal_pool_initialise_buffer_headers(MMAL_POOL_T *pool, unsi
    uint8_t *payload = NULL;
    unsigned int i;
 
-   header = (MMAL_BUFFER_HEADER_T *)((uint8_t *)pool->header + ROUND_UP(sizeof(void *)*headers,ALIGN));
+   header = (MMAL_BUFFER_HEADER_T *)((uint8_t *)pool->header + HEADERS_OFFSET(headers));
 
    for (i = 0; i < headers; i++)
    {
@@ -143,13 +254,15 @@ MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payl
 
    /* Calculate how much memory we need */
    pool_size = ROUND_UP(sizeof(MMAL_POOL_PRIVATE_T),ALIGN);
-   headers_array_size = ROUND_UP(sizeof(void *)*headers,ALIGN);
-   header_size = ROUND_UP(mmal_buffer_header_size(0),ALIGN);
+   headers_array_size = HEADERS_OFFSET(headers);
+   header_size = ALIGN_UP(mmal_buffer_header_size(0),CACHE_LINE);
 
    LOG_TRACE("allocating %u + %u + %u * %u bytes for pool",
              pool_size, headers_array_size, header_size, headers);
    private = vcos_calloc(pool_size, 1, "MMAL pool");
-   array = vcos_calloc(headers_array_size + header_size * headers, 1, "MMAL buffer headers");
+   array = vcos_malloc_aligned(headers_array_size + header_size * headers, CACHE_LINE, "MMAL buffer headers");
+   if (array)
+      memset(array, 0, headers_array_size + header_size * headers);
    if (!private || !array)
    {
       LOG_ERROR("failed to allocate pool");
@@ -178,6 +291,21 @@ MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payl
    private->allocator_free = allocator_free;
    private->allocator_context = allocator_context;
 
+#ifdef MMAL_POOL_CONTIGUOUS
+   /* Carve the default allocator's payloads from a single mapping */
+   if (allocator_alloc == mmal_pool_allocator_default_alloc)
+   {
+      private->allocator_alloc = mmal_pool_region_alloc;
+      private->allocator_free = mmal_pool_region_free;
+      private->allocator_context = &private->region;
+      if (mmal_pool_region_map(&private->region, headers, payload_size) != MMAL_SUCCESS)
+      {
+         mmal_pool_destroy(pool);
+         return NULL;
+      }
+   }
+#endif
+
    if (mmal_pool_initialise_buffer_headers(pool, headers, 1) != MMAL_SUCCESS)
    {
       mmal_pool_destroy(pool);
@@ -212,6 +340,10 @@ void mmal_pool_destroy(MMAL_POOL_T *pool)
    if (pool->header)
       vcos_free(pool->header);
 
+#ifdef MMAL_POOL_CONTIGUOUS
+   mmal_pool_region_unmap(&((MMAL_POOL_PRIVATE_T *)pool)->region);
+#endif
+
    if(pool->queue) mmal_queue_destroy(pool->queue);
    vcos_free(pool);
 }
@@ -245,13 +377,20 @@ MMAL_STATUS_T mmal_pool_resize(MMAL_POOL_T *pool, unsigned int headers, uint32_t
       if (pool->header)
          vcos_free(pool->header);
       pool->header =
-         vcos_calloc(private->header_size * headers + ROUND_UP(sizeof(void *)*headers,ALIGN),
-                     1, "MMAL buffer headers");
+         vcos_malloc_aligned(private->header_size * headers + HEADERS_OFFSET(headers),
+                             CACHE_LINE, "MMAL buffer headers");
       if (!pool->header)
          return MMAL_ENOMEM;
+      memset(pool->header, 0, private->header_size * headers + HEADERS_OFFSET(headers));
       private->headers_alloc_num = headers;
    }
 
+#ifdef MMAL_POOL_CONTIGUOUS
+   if (private->allocator_alloc == mmal_pool_region_alloc &&
+       mmal_pool_region_map(&private->region, headers, payload_size) != MMAL_SUCCESS)
+      return MMAL_ENOMEM;
+#endif
+
    /* Allocate the new payloads */
    private->payload_size = payload_size;
    mmal_pool_initialise_buffer_headers(pool, headers, 1);
@@ -272,7 +411,9 @@ static void mmal_pool_buffer_header_release(MMAL_BUFFER_HEADER_T *header)
    MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
    MMAL_BOOL_T queue_buffer = 1;
 
-   header->priv->refcount = 1;
+   /* Published to the next user by the queue. With MMAL_QUEUE_LOCKFREE the
+    * whole release path back to the pool is free of locks. */
+   __atomic_store_n(&header->priv->refcount, 1, __ATOMIC_RELAXED);
    if(private->cb)
       queue_buffer = private->cb(pool, header, private->userdata);
    if (queue_buffer)
@@ -293,7 +434,7 @@ void mmal_pool_pre_release_callback_set(MMAL_POOL_T *pool, MMAL_BH_PRE_RELEASE_C
    unsigned int i;
    MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
    MMAL_BUFFER_HEADER_T *header =
-         (MMAL_BUFFER_HEADER_T*)((uint8_t*)pool->header + ROUND_UP(sizeof(void*)*pool->headers_num,ALIGN));
+         (MMAL_BUFFER_HEADER_T*)((uint8_t*)pool->header + HEADERS_OFFSET(pool->headers_num));
 
    for (i = 0; i < pool->headers_num; ++i)
    {
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "util/mmal_util.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
+#include "core/mmal_buffer_private.h"
 #include "interface/vcos/vcos.h"
 #include "mmal_logging.h"
 #include "interface/mmal/util/mmal_util.h"
@@ -94,6 +95,8 @@ typedef struct MMAL_PORT_PRIVATE_CORE_T
 
    /** Per-port statistics collected directly by the MMAL core */
    MMAL_CORE_PORT_STATISTICS_T stats;
+   /** Time buffers spent in the port, updated with atomics rather than stats_lock */
+   MMAL_CORE_LATENCY_T latency;
 
    char *name; /**< Port name */
    unsigned int name_size; /** Size of the memory area reserved for the name string */
@@ -117,6 +120,8 @@ static MMAL_BOOL_T mmal_port_connected_pool_cb(MMAL_POOL_T *pool, MMAL_BUFFER_HE
 
 static void mmal_port_name_update(MMAL_PORT_T *port);
 static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction);
+static void mmal_port_update_port_stats_n(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction, unsigned int count);
+static void mmal_port_update_port_latency(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
 
 /*****************************************************************************/
 
@@ -144,6 +149,17 @@ static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR d
    if (!--(a)->priv->core->transit_buffer_headers) \
       vcos_semaphore_post(&(a)->priv->core->transit_sema); \
    vcos_mutex_unlock(&(a)->priv->core->transit_lock)
+#define IN_TRANSIT_ADD(a, n) \
+   vcos_mutex_lock(&(a)->priv->core->transit_lock); \
+   if (!(a)->priv->core->transit_buffer_headers) \
+      vcos_semaphore_wait(&(a)->priv->core->transit_sema); \
+   (a)->priv->core->transit_buffer_headers += (n); \
+   vcos_mutex_unlock(&(a)->priv->core->transit_lock)
+#define IN_TRANSIT_SUBTRACT(a, n) \
+   vcos_mutex_lock(&(a)->priv->core->transit_lock); \
+   if (!((a)->priv->core->transit_buffer_headers -= (n))) \
+      vcos_semaphore_post(&(a)->priv->core->transit_sema); \
+   vcos_mutex_unlock(&(a)->priv->core->transit_lock)
 #define IN_TRANSIT_WAIT(a) \
    vcos_semaphore_wait(&(a)->priv->core->transit_sema); \
    vcos_semaphore_post(&(a)->priv->core->transit_sema)
@@ -752,6 +768,7 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    /* coverity[lock_order] since transit_sema is not a lock, there is no ordering conflict */
    IN_TRANSIT_INCREMENT(port);
 
+   buffer->priv->send_time = vcos_getmicrosecs();
    if (port->priv->core->is_paused)
    {
       /* Add buffer to our internal queue */
@@ -779,6 +796,102 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    return status;
 }
 
+/** Send several buffer headers to a port */
+MMAL_STATUS_T mmal_port_send_buffers(MMAL_PORT_T *port,
+   MMAL_BUFFER_HEADER_T **buffers, unsigned int *count)
+{
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   MMAL_BUFFER_HEADER_T *buffer;
+   unsigned int total, sent;
+   uint32_t now;
+
+   if (!port || !port->priv || !buffers || !count)
+   {
+      LOG_ERROR("invalid port");
+      if (count) *count = 0;
+      return MMAL_EINVAL;
+   }
+
+   total = *count;
+   *count = 0;
+   if (!total)
+      return MMAL_SUCCESS;
+
+   for (sent = 0; sent < total; sent++)
+   {
+      buffer = buffers[sent];
+      if (buffer->alloc_size && !buffer->data &&
+          !(port->capabilities & MMAL_PORT_CAPABILITY_PASSTHROUGH))
+      {
+         LOG_ERROR("%s(%p) received invalid buffer header", port->name, port);
+         return MMAL_EINVAL;
+      }
+   }
+
+   if (!port->priv->pf_send)
+      return MMAL_ENOSYS;
+
+   LOCK_SENDING(port);
+
+   if (!port->is_enabled)
+   {
+      UNLOCK_SENDING(port);
+      return MMAL_EINVAL;
+   }
+
+   /* coverity[lock] transit_sema is used for signalling, and is not a lock */
+   /* coverity[lock_order] since transit_sema is not a lock, there is no ordering conflict */
+   IN_TRANSIT_ADD(port, total);
+
+   now = vcos_getmicrosecs();
+   for (sent = 0; sent < total && status == MMAL_SUCCESS; sent++)
+   {
+      buffer = buffers[sent];
+
+#ifdef ENABLE_MMAL_EXTRA_LOGGING
+      LOG_TRACE("%s(%i:%i) port %p, buffer %p (%p,%i,%i)",
+                port->component->name, (int)port->type, (int)port->index, port, buffer,
+                buffer->data, (int)buffer->offset, (int)buffer->length);
+#endif
+
+      if (port->type == MMAL_PORT_TYPE_OUTPUT && buffer->length)
+      {
+         LOG_DEBUG("given an output buffer with length != 0");
+         buffer->length = 0;
+      }
+
+      buffer->priv->send_time = now;
+      if (port->priv->core->is_paused)
+      {
+         /* Add buffer to our internal queue */
+         buffer->next = NULL;
+         *port->priv->core->queue_last = buffer;
+         port->priv->core->queue_last = &buffer->next;
+      }
+      else
+      {
+         /* Send buffer to component. pf_send takes a single buffer header,
+          * but the port stays locked for the whole batch. */
+         status = port->priv->pf_send(port, buffer);
+      }
+   }
+
+   if (status != MMAL_SUCCESS)
+   {
+      /* the failed buffer header and the ones after it stay with the caller */
+      sent--;
+      IN_TRANSIT_SUBTRACT(port, total - sent);
+      LOG_ERROR("%s: send failed: %s", port->name, mmal_status_to_string(status));
+   }
+
+   if (sent)
+      mmal_port_update_port_stats_n(port, MMAL_CORE_STATS_RX, sent);
+
+   UNLOCK_SENDING(port);
+   *count = sent;
+   return status;
+}
+
 /** Flush a port */
 MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port)
 {
@@ -911,6 +1024,10 @@ void mmal_port_buffer_header_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *b
       mmal_port_update_port_stats(port, MMAL_CORE_STATS_TX);
    }
 
+   /* before the client callback, which may recycle the buffer header */
+   if (!buffer->cmd)
+      mmal_port_update_port_latency(port, buffer);
+
    port->priv->core->buffer_header_callback(port, buffer);
 
    IN_TRANSIT_DECREMENT(port);
@@ -1239,29 +1356,33 @@ static MMAL_STATUS_T mmal_port_populate_from_pool(MMAL_PORT_T* port, MMAL_POOL_T
 {
    MMAL_STATUS_T status = MMAL_SUCCESS;
    uint32_t buffer_idx;
-   MMAL_BUFFER_HEADER_T *buffer;
+   MMAL_BUFFER_HEADER_T *buffers[16];
+   unsigned int count, sent;
 
    if (!port->priv->pf_send)
       return MMAL_ENOSYS;
 
    LOG_TRACE("%s port %p, pool: %p", port->name, port, pool);
 
-   /* Populate port from pool */
-   for (buffer_idx = 0; buffer_idx < port->buffer_num; buffer_idx++)
+   /* Populate port from pool, a batch at a time */
+   for (buffer_idx = 0; buffer_idx < port->buffer_num; buffer_idx += count)
    {
-      buffer = mmal_queue_get(pool->queue);
-      if (!buffer)
+      count = mmal_queue_get_n(pool->queue, buffers,
+                               vcos_min(port->buffer_num - buffer_idx, vcos_countof(buffers)));
+      if (!count)
       {
          LOG_ERROR("too few buffers in the pool");
          status = MMAL_ENOMEM;
          break;
       }
 
-      status = mmal_port_send_buffer(port, buffer);
+      sent = count;
+      status = mmal_port_send_buffers(port, buffers, &sent);
       if (status != MMAL_SUCCESS)
       {
          LOG_ERROR("failed to send buffer to port");
-         mmal_buffer_header_release(buffer);
+         for (; sent < count; sent++)
+            mmal_buffer_header_release(buffers[sent]);
          break;
       }
    }
@@ -1411,10 +1532,62 @@ static MMAL_STATUS_T mmal_port_get_core_stats(MMAL_PORT_T *port, MMAL_PARAMETER_
    return MMAL_SUCCESS;
 }
 
+/** Get the latency histogram of a port */
+MMAL_STATUS_T mmal_port_latency_get(MMAL_PORT_T *port,
+   MMAL_CORE_LATENCY_T *latency, MMAL_BOOL_T reset)
+{
+   MMAL_CORE_LATENCY_T *src;
+   unsigned int i;
+
+   if (!port || !port->priv || !latency)
+      return MMAL_EINVAL;
+
+   /* Buffers returned meanwhile may be counted in some fields and not others,
+    * which doesn't matter for a histogram */
+   src = &port->priv->core->latency;
+   if (reset)
+   {
+      latency->count = __atomic_exchange_n(&src->count, 0, __ATOMIC_RELAXED);
+      latency->max = __atomic_exchange_n(&src->max, 0, __ATOMIC_RELAXED);
+      for (i = 0; i < MMAL_CORE_LATENCY_BUCKETS; i++)
+         latency->buckets[i] = __atomic_exchange_n(&src->buckets[i], 0, __ATOMIC_RELAXED);
+   }
+   else
+   {
+      latency->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+      latency->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+      for (i = 0; i < MMAL_CORE_LATENCY_BUCKETS; i++)
+         latency->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+   }
+   return MMAL_SUCCESS;
+}
+
+/** Record the time a returned buffer spent in the port.
+ * Ports may return buffers from several threads, so this only uses atomics. */
+static void mmal_port_update_port_latency(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_CORE_LATENCY_T *latency = &port->priv->core->latency;
+   uint32_t elapsed = vcos_getmicrosecs() - buffer->priv->send_time;
+   uint32_t max = __atomic_load_n(&latency->max, __ATOMIC_RELAXED);
+   unsigned int bucket = elapsed ? 31 - __builtin_clz(elapsed) : 0;
+
+   __atomic_fetch_add(&latency->buckets[bucket], 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&latency->count, 1, __ATOMIC_RELAXED);
+   while (elapsed > max &&
+          !__atomic_compare_exchange_n(&latency->max, &max, elapsed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+}
+
 /** Update the port stats, called per buffer.
  *
  */
 static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction)
+{
+   mmal_port_update_port_stats_n(port, direction, 1);
+}
+
+/** Account for count buffers passing through the port at the same time */
+static void mmal_port_update_port_stats_n(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction, unsigned int count)
 {
    MMAL_PORT_PRIVATE_CORE_T *core = port->priv->core;
    MMAL_CORE_STATISTICS_T *stats;
@@ -1424,7 +1597,7 @@ static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR d
 
    stats = direction == MMAL_CORE_STATS_RX ? &core->stats.rx : &core->stats.tx;
 
-   stats->buffer_count++;
+   stats->buffer_count += count;
 
    if (!stats->first_buffer_time)
    {
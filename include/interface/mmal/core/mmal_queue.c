@@ -28,6 +28,324 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mmal.h"
 #include "mmal_queue.h"
 
+#ifdef MMAL_QUEUE_LOCKFREE
+
+#ifndef __linux__
+#error "MMAL_QUEUE_LOCKFREE needs Linux futexes"
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Definition of the QUEUE
+ *
+ * Intrusive multi-producer queue (D. Vyukov): a producer swaps its buffer in
+ * as the new head and links the previous head to it, without any lock.
+ * Consumers serialise on consumer_lock, which is uncontended when a single
+ * thread drains the queue, the usual case.
+ *
+ * length counts the buffers a consumer may claim. It is only incremented once
+ * a buffer is linked, so mmal_queue_get() succeeds whenever
+ * mmal_queue_length() was non-zero, and it is the futex word waiting
+ * consumers sleep on. */
+struct MMAL_QUEUE_T
+{
+   MMAL_BUFFER_HEADER_T *head;   /**< Last buffer put, swapped by producers */
+   MMAL_BUFFER_HEADER_T stub;    /**< Placeholder keeping the list non-empty, also keeps head and tail apart */
+   MMAL_BUFFER_HEADER_T *tail;   /**< Next buffer to get, consumers only */
+   MMAL_BUFFER_HEADER_T *front;  /**< Buffers put back, taken before the list, consumers only */
+   VCOS_MUTEX_T consumer_lock;
+   int length;
+   int waiters;
+};
+
+static void mmal_queue_futex_wake(int *word, int count)
+{
+   syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/** Sleeps while *word is 0, until the absolute CLOCK_MONOTONIC deadline if not NULL.
+ * Returns 0 if the deadline passed. */
+static int mmal_queue_futex_wait(int *word, const struct timespec *deadline)
+{
+   if (!deadline)
+      return syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0) == 0 || errno != ETIMEDOUT;
+   return syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, 0, deadline, NULL, FUTEX_BITSET_MATCH_ANY) == 0 ||
+      errno != ETIMEDOUT;
+}
+
+/** Links a chain of buffers, already linked from first to last, at the head of the list */
+static void mmal_queue_push_chain(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *first,
+                                  MMAL_BUFFER_HEADER_T *last)
+{
+   MMAL_BUFFER_HEADER_T *prev;
+
+   __atomic_store_n(&last->next, NULL, __ATOMIC_RELAXED);
+   prev = __atomic_exchange_n(&queue->head, last, __ATOMIC_ACQ_REL);
+   /* until this store, consumers see the list end at prev */
+   __atomic_store_n(&prev->next, first, __ATOMIC_RELEASE);
+}
+
+/** Links a buffer at the head of the list */
+static void mmal_queue_push(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+   mmal_queue_push_chain(queue, buffer, buffer);
+}
+
+/** Unlinks the buffer at the tail of the list, consumer_lock must be held.
+ * Returns NULL if the list is empty or a producer is half way through a push. */
+static MMAL_BUFFER_HEADER_T *mmal_queue_pop(MMAL_QUEUE_T *queue)
+{
+   MMAL_BUFFER_HEADER_T *tail = queue->tail;
+   MMAL_BUFFER_HEADER_T *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+   if (tail == &queue->stub)
+   {
+      if (!next)
+         return NULL;
+      queue->tail = next;
+      tail = next;
+      next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+   }
+   if (next)
+   {
+      queue->tail = next;
+      return tail;
+   }
+   if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+      return NULL;
+
+   /* tail is the last buffer, put the stub behind it so it can be unlinked */
+   mmal_queue_push(queue, &queue->stub);
+   next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   if (next)
+   {
+      queue->tail = next;
+      return tail;
+   }
+   return NULL;
+}
+
+/** Makes count more buffers available to consumers */
+static void mmal_queue_signal(MMAL_QUEUE_T *queue, unsigned int count)
+{
+   /* pairs with the waiters increment in mmal_queue_claim_wait() */
+   __atomic_add_fetch(&queue->length, (int)count, __ATOMIC_SEQ_CST);
+   if (__atomic_load_n(&queue->waiters, __ATOMIC_SEQ_CST))
+      mmal_queue_futex_wake(&queue->length, count > INT_MAX ? INT_MAX : (int)count);
+}
+
+/** Claims up to count of the available buffers without waiting.
+ * Returns the number of buffers claimed. */
+static unsigned int mmal_queue_claim_n(MMAL_QUEUE_T *queue, unsigned int count)
+{
+   int length = __atomic_load_n(&queue->length, __ATOMIC_RELAXED);
+   int claimed;
+
+   while (length > 0 && count)
+   {
+      claimed = (unsigned int)length < count ? length : (int)count;
+      if (__atomic_compare_exchange_n(&queue->length, &length, length - claimed, 1,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+         return (unsigned int)claimed;
+   }
+   return 0;
+}
+
+/** Claims one of the available buffers without waiting */
+static int mmal_queue_claim(MMAL_QUEUE_T *queue)
+{
+   return mmal_queue_claim_n(queue, 1) != 0;
+}
+
+/** Claims one of the available buffers, waiting until the deadline if not NULL */
+static int mmal_queue_claim_wait(MMAL_QUEUE_T *queue, const struct timespec *deadline)
+{
+   int awake = 1;
+
+   while (!mmal_queue_claim(queue))
+   {
+      if (!awake)
+         return 0;
+      __atomic_add_fetch(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+      if (!__atomic_load_n(&queue->length, __ATOMIC_SEQ_CST))
+         awake = mmal_queue_futex_wait(&queue->length, deadline);
+      __atomic_sub_fetch(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+   }
+   return 1;
+}
+
+/** Create a QUEUE of MMAL_BUFFER_HEADER_T */
+MMAL_QUEUE_T *mmal_queue_create(void)
+{
+   MMAL_QUEUE_T *queue;
+
+   queue = vcos_calloc(1, sizeof(*queue), "MMAL queue");
+   if(!queue) return 0;
+
+   if(vcos_mutex_create(&queue->consumer_lock, "MMAL queue lock") != VCOS_SUCCESS )
+   {
+      vcos_free(queue);
+      return 0;
+   }
+
+   queue->head = &queue->stub;
+   queue->tail = &queue->stub;
+   return queue;
+}
+
+/** Put a MMAL_BUFFER_HEADER_T into a QUEUE */
+void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+   vcos_assert(queue && buffer);
+   if(!queue || !buffer) return;
+
+   mmal_queue_push(queue, buffer);
+   mmal_queue_signal(queue, 1);
+}
+
+/** Put several MMAL_BUFFER_HEADER_T into a QUEUE */
+void mmal_queue_put_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count)
+{
+   unsigned int i;
+
+   vcos_assert(queue && (buffers || !count));
+   if(!queue || !buffers || !count) return;
+
+   /* the chain is private until it is pushed, so a single exchange links it all */
+   for (i = 0; i + 1 < count; i++)
+      __atomic_store_n(&buffers[i]->next, buffers[i + 1], __ATOMIC_RELAXED);
+   mmal_queue_push_chain(queue, buffers[0], buffers[count - 1]);
+   mmal_queue_signal(queue, count);
+}
+
+/** Put a MMAL_BUFFER_HEADER_T back at the start of a QUEUE. */
+void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+   if(!queue || !buffer) return;
+
+   vcos_mutex_lock(&queue->consumer_lock);
+   buffer->next = queue->front;
+   queue->front = buffer;
+   vcos_mutex_unlock(&queue->consumer_lock);
+   mmal_queue_signal(queue, 1);
+}
+
+/** Take a claimed MMAL_BUFFER_HEADER_T, consumer_lock must be held */
+static MMAL_BUFFER_HEADER_T *mmal_queue_take(MMAL_QUEUE_T *queue)
+{
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   buffer = queue->front;
+   if (buffer)
+      queue->front = buffer->next;
+   else
+      while ((buffer = mmal_queue_pop(queue)) == NULL)
+         sched_yield(); /* the producer of a claimed buffer was preempted mid-push */
+
+   return buffer;
+}
+
+/** Get a MMAL_BUFFER_HEADER_T from a QUEUE. Buffer already claimed */
+static MMAL_BUFFER_HEADER_T *mmal_queue_get_core(MMAL_QUEUE_T *queue)
+{
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   vcos_mutex_lock(&queue->consumer_lock);
+   buffer = mmal_queue_take(queue);
+   vcos_mutex_unlock(&queue->consumer_lock);
+
+   return buffer;
+}
+
+/** Get a MMAL_BUFFER_HEADER_T from a QUEUE. */
+MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue)
+{
+   vcos_assert(queue);
+   if(!queue) return 0;
+
+   if(!mmal_queue_claim(queue))
+       return NULL;
+
+   return mmal_queue_get_core(queue);
+}
+
+/** Get several MMAL_BUFFER_HEADER_T from a QUEUE. */
+unsigned int mmal_queue_get_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count)
+{
+   unsigned int claimed, i;
+
+   vcos_assert(queue && (buffers || !count));
+   if(!queue || !buffers) return 0;
+
+   claimed = mmal_queue_claim_n(queue, count);
+   if(!claimed)
+      return 0;
+
+   vcos_mutex_lock(&queue->consumer_lock);
+   for (i = 0; i < claimed; i++)
+      buffers[i] = mmal_queue_take(queue);
+   vcos_mutex_unlock(&queue->consumer_lock);
+
+   return claimed;
+}
+
+/** Wait for a MMAL_BUFFER_HEADER_T from a QUEUE. */
+MMAL_BUFFER_HEADER_T *mmal_queue_wait(MMAL_QUEUE_T *queue)
+{
+   if(!queue) return 0;
+
+   if(!mmal_queue_claim_wait(queue, NULL))
+       return NULL;
+
+   return mmal_queue_get_core(queue);
+}
+
+MMAL_BUFFER_HEADER_T *mmal_queue_timedwait(MMAL_QUEUE_T *queue, VCOS_UNSIGNED timeout)
+{
+   struct timespec deadline;
+
+   if (!queue)
+      return NULL;
+
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   deadline.tv_sec += timeout / 1000;
+   deadline.tv_nsec += (timeout % 1000) * 1000000;
+   if (deadline.tv_nsec >= 1000000000)
+   {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+   }
+
+   if (!mmal_queue_claim_wait(queue, &deadline))
+      return NULL;
+
+   return mmal_queue_get_core(queue);
+}
+
+/** Get the number of MMAL_BUFFER_HEADER_T currently in a QUEUE */
+unsigned int mmal_queue_length(MMAL_QUEUE_T *queue)
+{
+	if(!queue) return 0;
+
+	return __atomic_load_n(&queue->length, __ATOMIC_RELAXED);
+}
+
+/** Destroy a queue of MMAL_BUFFER_HEADER_T */
+void mmal_queue_destroy(MMAL_QUEUE_T *queue)
+{
+   if(!queue) return;
+   vcos_mutex_delete(&queue->consumer_lock);
+   vcos_free(queue);
+}
+
+#else /* MMAL_QUEUE_LOCKFREE */
+
 /** Definition of the QUEUE */
 struct MMAL_QUEUE_T
 {
@@ -111,6 +429,28 @@ void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
    vcos_mutex_unlock(&queue->lock);
 }
 
+/** Put several MMAL_BUFFER_HEADER_T into a QUEUE */
+void mmal_queue_put_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count)
+{
+   unsigned int i;
+
+   vcos_assert(queue && (buffers || !count));
+   if(!queue || !buffers) return;
+
+   vcos_mutex_lock(&queue->lock);
+   for (i = 0; i < count; i++)
+   {
+      mmal_queue_sanity_check(queue, buffers[i]);
+      queue->length++;
+      *queue->last = buffers[i];
+      buffers[i]->next = 0;
+      queue->last = &buffers[i]->next;
+      // posted under the lock for the same reason as in mmal_queue_put()
+      vcos_semaphore_post(&queue->semaphore);
+   }
+   vcos_mutex_unlock(&queue->lock);
+}
+
 /** Put a MMAL_BUFFER_HEADER_T back at the start of a QUEUE. */
 void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
 {
@@ -158,6 +498,31 @@ MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue)
    return mmal_queue_get_core(queue);
 }
 
+/** Get several MMAL_BUFFER_HEADER_T from a QUEUE. */
+unsigned int mmal_queue_get_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count)
+{
+   unsigned int n;
+
+   vcos_assert(queue && (buffers || !count));
+   if(!queue || !buffers) return 0;
+
+   vcos_mutex_lock(&queue->lock);
+   mmal_queue_sanity_check(queue, NULL);
+   // a count taken from the semaphore while holding the lock is always linked,
+   // since puts post under the lock
+   for (n = 0; n < count && vcos_semaphore_trywait(&queue->semaphore) == VCOS_SUCCESS; n++)
+   {
+      buffers[n] = queue->first;
+      vcos_assert(buffers[n] != NULL);
+      queue->first = buffers[n]->next;
+      if(!queue->first) queue->last = &queue->first;
+      queue->length--;
+   }
+   vcos_mutex_unlock(&queue->lock);
+
+   return n;
+}
+
 /** Wait for a MMAL_BUFFER_HEADER_T from a QUEUE. */
 MMAL_BUFFER_HEADER_T *mmal_queue_wait(MMAL_QUEUE_T *queue)
 {
@@ -196,3 +561,5 @@ void mmal_queue_destroy(MMAL_QUEUE_T *queue)
    vcos_semaphore_delete(&queue->semaphore);
    vcos_free(queue);
 }
+
+#endif /* MMAL_QUEUE_LOCKFREE */
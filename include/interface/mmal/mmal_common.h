@@ -77,6 +77,21 @@ typedef struct MMAL_CORE_PORT_STATISTICS_T
    MMAL_CORE_STATISTICS_T tx;
 } MMAL_CORE_PORT_STATISTICS_T;
 
+/** Number of buckets in a MMAL_CORE_LATENCY_T histogram */
+#define MMAL_CORE_LATENCY_BUCKETS 32
+
+/** Histogram of the time buffers spent in a port, from being sent to the port
+ * until the port returned them, collected by the core on all ports.
+ */
+typedef struct MMAL_CORE_LATENCY_T
+{
+   uint32_t count;      /**< Number of buffers returned by the port */
+   uint32_t max;        /**< Longest time (us) a buffer spent in the port */
+   /** Bucket i counts the buffers which spent [2^i, 2^(i+1)) us in the port,
+    * bucket 0 also counts those which spent less than 1us */
+   uint32_t buckets[MMAL_CORE_LATENCY_BUCKETS];
+} MMAL_CORE_LATENCY_T;
+
 /** Unsigned 16.16 fixed point value, also known as Q16.16 */
 typedef uint32_t MMAL_FIXED_16_16_T;
 
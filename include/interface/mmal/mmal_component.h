@@ -139,6 +139,21 @@ MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T *component);
  */
 MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T *component);
 
+/** Set the scheduling of the thread the core runs the component's action on
+ * Components such as the VideoCore ones process their callbacks on an action
+ * thread. Running it with a real-time policy on a CPU of its own keeps other
+ * threads of the process from delaying buffers. Applies to the running action
+ * thread, if any, and to the one registered next.
+ *
+ * @param component component to configure
+ * @param policy SCHED_OTHER, SCHED_FIFO or SCHED_RR
+ * @param priority priority for SCHED_FIFO and SCHED_RR, ignored for SCHED_OTHER
+ * @param cpus mask of the CPUs the thread may run on, bit n standing for CPU n, 0 for all
+ * @return MMAL_SUCCESS on success, MMAL_ENOSPC if the process may not use the policy
+ */
+MMAL_STATUS_T mmal_component_action_scheduling_set(MMAL_COMPONENT_T *component,
+   int policy, int priority, uint32_t cpus);
+
 /* @} */
 
 #ifdef __cplusplus
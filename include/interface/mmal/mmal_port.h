@@ -216,6 +216,35 @@ MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
 MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    MMAL_BUFFER_HEADER_T *buffer);
 
+/** Send several buffer headers to a port.
+ * This is the same as calling mmal_port_send_buffer() for each buffer header,
+ * except that the port is only locked once for the whole batch. Sending stops
+ * at the first failure, the buffer headers which weren't sent stay with the
+ * caller.
+ *
+ * @param port The port to which the buffer headers are to be sent.
+ * @param buffers Array of pointers to the buffer headers to send.
+ * @param count On input, the number of buffer headers in the array.
+ *              On output, the number of buffer headers sent.
+ * @return MMAL_SUCCESS if all the buffer headers were sent
+ */
+MMAL_STATUS_T mmal_port_send_buffers(MMAL_PORT_T *port,
+   MMAL_BUFFER_HEADER_T **buffers, unsigned int *count);
+
+/** Get the histogram of the time buffer headers spent in a port.
+ * The core records the time between a buffer header being sent to the port
+ * and the port returning it, without taking any lock. Together with the
+ * histograms of the other ports of a pipeline, this shows which component
+ * holds on to buffers.
+ *
+ * @param port The port to query.
+ * @param latency Filled in with the histogram.
+ * @param reset Reset the histogram to zero after reading it.
+ * @return MMAL_SUCCESS on success
+ */
+MMAL_STATUS_T mmal_port_latency_get(MMAL_PORT_T *port,
+   MMAL_CORE_LATENCY_T *latency, MMAL_BOOL_T reset);
+
 /** Connect an output port to an input port.
  *
  * When connected and enabled, buffers will automatically progress from the
@@ -64,6 +64,16 @@ void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
  */
 void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
 
+/** Put several MMAL_BUFFER_HEADER_T into a queue, in array order.
+ * This is the same as calling mmal_queue_put() for each buffer header, except
+ * that the queue is only synchronised once for the whole batch.
+ *
+ * @param queue   Pointer to a queue
+ * @param buffers Array of pointers to the MMAL_BUFFER_HEADER_T to add to the queue
+ * @param count   Number of buffer headers in the array
+ */
+void mmal_queue_put_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count);
+
 /** Get a MMAL_BUFFER_HEADER_T from a queue
  *
  * @param queue  Pointer to a queue
@@ -72,6 +82,17 @@ void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
  */
 MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue);
 
+/** Get up to a given number of MMAL_BUFFER_HEADER_T from a queue, without waiting.
+ * The queue is only synchronised once for the whole batch.
+ *
+ * @param queue   Pointer to a queue
+ * @param buffers Array receiving the pointers to the MMAL_BUFFER_HEADER_T, in queue order
+ * @param count   Maximum number of buffer headers to get
+ *
+ * @return number of buffer headers stored in the array, 0 if the queue is empty.
+ */
+unsigned int mmal_queue_get_n(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T **buffers, unsigned int count);
+
 /** Wait for a MMAL_BUFFER_HEADER_T from a queue.
  * This is the same as a get except that this will block until a buffer header is
  * available.
@@ -146,6 +146,9 @@ typedef struct VCOS_THREAD_ATTR_T
    VCOS_UNSIGNED ta_affinity;
    VCOS_UNSIGNED ta_timeslice;
    VCOS_UNSIGNED legacy;
+   int ta_policy;                /**< SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+   int ta_sched_priority;        /**< Priority for SCHED_FIFO and SCHED_RR */
+   VCOS_UNSIGNED ta_cpus;        /**< Mask of the CPUs the thread may run on, 0 for all */
 } VCOS_THREAD_ATTR_T;
 
 /** Called at thread exit.
@@ -429,6 +432,21 @@ void vcos_thread_attr_setaffinity(VCOS_THREAD_ATTR_T *attrs, VCOS_UNSIGNED affin
    attrs->ta_affinity = affinity;
 }
 
+/** Set the scheduling policy and priority of the thread, e.g. SCHED_FIFO.
+  * Ignored by vcos_thread_create() if the process may not use it.
+  */
+VCOS_INLINE_IMPL
+void vcos_thread_attr_setscheduling(VCOS_THREAD_ATTR_T *attrs, int policy, int priority) {
+   attrs->ta_policy = policy;
+   attrs->ta_sched_priority = priority;
+}
+
+/** Restrict the thread to a set of CPUs, bit n standing for CPU n. */
+VCOS_INLINE_IMPL
+void vcos_thread_attr_setcpus(VCOS_THREAD_ATTR_T *attrs, VCOS_UNSIGNED cpus) {
+   attrs->ta_cpus = cpus;
+}
+
 VCOS_INLINE_IMPL
 void vcos_thread_attr_settimeslice(VCOS_THREAD_ATTR_T *attrs, VCOS_UNSIGNED ts) {
    attrs->ta_timeslice = ts;
@@ -66,6 +66,7 @@ typedef void (*LEGACY_ENTRY_FN_T)(int, void *);
 
 static VCOS_THREAD_ATTR_T default_attrs = {
    .ta_stacksz = VCOS_DEFAULT_STACK_SIZE,
+   .ta_policy = SCHED_OTHER,
 };
 
 /** Singleton global lock used for vcos_global_lock/unlock(). */
@@ -199,6 +200,26 @@ VCOS_STATUS_T vcos_thread_create(VCOS_THREAD_T *thread,
 
    /* pthread_attr_setpriority(&pt_attrs, local_attrs->ta_priority); */
 
+   if (local_attrs->ta_policy != SCHED_OTHER)
+   {
+      struct sched_param param = { .sched_priority = local_attrs->ta_sched_priority };
+      pthread_attr_setinheritsched(&pt_attrs, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&pt_attrs, local_attrs->ta_policy);
+      pthread_attr_setschedparam(&pt_attrs, &param);
+   }
+
+   if (local_attrs->ta_cpus)
+   {
+      cpu_set_t cpus;
+      unsigned int cpu;
+
+      CPU_ZERO(&cpus);
+      for (cpu = 0; cpu < sizeof(local_attrs->ta_cpus) * 8; cpu++)
+         if (local_attrs->ta_cpus & (1u << cpu))
+            CPU_SET(cpu, &cpus);
+      pthread_attr_setaffinity_np(&pt_attrs, sizeof(cpus), &cpus);
+   }
+
    vcos_assert(local_attrs->ta_stackaddr == 0); /* Not possible */
 
    thread->entry = entry;
@@ -210,6 +231,12 @@ VCOS_STATUS_T vcos_thread_create(VCOS_THREAD_T *thread,
    memset(thread->at_exit, 0, sizeof(thread->at_exit));
 
    rc = pthread_create(&thread->thread, &pt_attrs, vcos_thread_entry, thread);
+   if (rc == EPERM && local_attrs->ta_policy != SCHED_OTHER)
+   {
+      /* No CAP_SYS_NICE or RLIMIT_RTPRIO, run with the creator's policy instead */
+      pthread_attr_setinheritsched(&pt_attrs, PTHREAD_INHERIT_SCHED);
+      rc = pthread_create(&thread->thread, &pt_attrs, vcos_thread_entry, thread);
+   }
 
    pthread_attr_destroy(&pt_attrs);
 
@@ -0,0 +1,218 @@
+#include "actuator.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+using namespace std;
+
+namespace {
+
+uint64_t pack(const ControlMailbox::Command &command) {
+    return uint64_t(uint16_t(command.steering)) << 48 | uint64_t(uint16_t(command.throttle)) << 32 |
+           command.postedAt;
+}
+
+ControlMailbox::Command unpack(uint64_t value) {
+    return {int(uint16_t(value >> 48)), int(uint16_t(value >> 32)), uint32_t(value)};
+}
+
+/// One output moving linearly towards the latest command
+struct Ramp {
+    double from = 0;
+    double to = 0;
+    optional<int> applied = nullopt;
+
+    void retarget(double target, double current) {
+        from = current;
+        to = target;
+    }
+
+    double at(double progress) const {
+        return from + (to - from) * progress;
+    }
+};
+
+void addNanoseconds(timespec &time, long nanoseconds) {
+    time.tv_nsec += nanoseconds;
+    while (time.tv_nsec >= 1000000000L) {
+        time.tv_nsec -= 1000000000L;
+        time.tv_sec++;
+    }
+}
+
+bool isAfter(const timespec &a, const timespec &b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+} // namespace
+
+uint32_t ControlMailbox::now() {
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    // 0 marks an empty mailbox
+    return uint32_t(ms) != 0 ? uint32_t(ms) : 1;
+}
+
+void ControlMailbox::post(optional<int> steering, optional<int> throttle) {
+    // out of range values would wrap around in the packed slot
+    if (steering.has_value()) {
+        steering = clamp(steering.value(), minPulseWidth, maxPulseWidth);
+    }
+    if (throttle.has_value()) {
+        throttle = clamp(throttle.value(), minPulseWidth, maxPulseWidth);
+    }
+    uint64_t current = slot.load(memory_order_relaxed);
+    uint64_t updated;
+    do {
+        Command command = current != 0 ? unpack(current) : Command{1500, 1500, 0};
+        command.steering = steering.value_or(command.steering);
+        command.throttle = throttle.value_or(command.throttle);
+        command.postedAt = now();
+        updated = pack(command);
+    } while (!slot.compare_exchange_weak(current, updated, memory_order_release, memory_order_relaxed));
+}
+
+optional<ControlMailbox::Command> ControlMailbox::latest() const {
+    uint64_t value = slot.load(memory_order_acquire);
+    if (value == 0) {
+        return nullopt;
+    }
+    return unpack(value);
+}
+
+ActuatorThread::ActuatorThread(ControlMailbox &mailbox, ServoOutput &steering, ServoOutput &throttle, Config config)
+    : mailbox(mailbox), steering(steering), throttle(throttle), config(config) {}
+
+ActuatorThread::ActuatorThread(ControlMailbox &mailbox, ServoOutput &steering, ServoOutput &throttle)
+    : ActuatorThread(mailbox, steering, throttle, Config()) {}
+
+ActuatorThread::~ActuatorThread() {
+    stop();
+}
+
+void ActuatorThread::start() {
+    quit = false;
+    thread = std::thread(&ActuatorThread::actuatorThreadHandler, this);
+    if (config.priority > 0) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        int err = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+        if (err != 0) {
+            // needs root or CAP_SYS_NICE
+            std::cout << "Unable to set SCHED_FIFO for the actuator thread: " << strerror(err) << std::endl;
+        }
+    }
+}
+
+void ActuatorThread::stop() {
+    quit = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+ActuatorThread::Stats ActuatorThread::stats() const {
+    Stats stats;
+    stats.missedDeadlines = missedDeadlines.load(memory_order_relaxed);
+    stats.staleCommands = staleCommands.load(memory_order_relaxed);
+    stats.failsafeEvents = failsafeEvents.load(memory_order_relaxed);
+    stats.failsafeActive = failsafeActive.load(memory_order_relaxed);
+    return stats;
+}
+
+void ActuatorThread::actuatorThreadHandler() {
+    const long periodNs = long(chrono::duration_cast<chrono::nanoseconds>(config.period).count());
+    const uint32_t interpolationMs = uint32_t(config.interpolation.count());
+    const uint32_t deadlineMs = uint32_t(config.commandDeadline.count());
+    const uint32_t failsafeTimeoutMs = uint32_t(config.failsafeTimeout.count());
+    // full range of 1000 us to neutral in failsafeRamp
+    const double failsafeStep = config.failsafeRamp.count() > 0
+        ? 1000.0 * double(periodNs) / 1e6 / double(config.failsafeRamp.count()) : 1000.0;
+
+    Ramp steeringRamp, throttleRamp;
+    optional<ControlMailbox::Command> lastCommand = nullopt;
+    uint32_t rampStart = 0;
+
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!quit) {
+        addNanoseconds(next, periodNs);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+        timespec woke;
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        timespec nextPeriod = next;
+        addNanoseconds(nextPeriod, periodNs);
+        if (isAfter(woke, nextPeriod)) {
+            missedDeadlines.fetch_add(1, memory_order_relaxed);
+            // skip the periods we missed instead of catching up
+            next = woke;
+        }
+
+        auto command = mailbox.latest();
+        if (!command.has_value()) {
+            continue;
+        }
+        uint32_t now = ControlMailbox::now();
+        if (now - command->postedAt > failsafeTimeoutMs) {
+            if (!failsafeActive.load(memory_order_relaxed)) {
+                failsafeActive.store(true, memory_order_relaxed);
+                auto events = failsafeEvents.fetch_add(1, memory_order_relaxed) + 1;
+                std::cout << "Failsafe: no control for " << (now - command->postedAt) << " ms, throttle to neutral ("
+                          << events << " events)" << std::endl;
+                // stop any interpolation where it is
+                if (throttleRamp.applied.has_value()) {
+                    throttleRamp.retarget(throttleRamp.applied.value(), throttleRamp.applied.value());
+                }
+            }
+            // hold steering, step the throttle towards neutral
+            if (throttleRamp.applied.has_value() && throttleRamp.applied != config.neutralThrottle) {
+                double current = throttleRamp.at(1.0);
+                double target = config.neutralThrottle;
+                double rampTarget = current < target ? min(target, current + failsafeStep) : max(target, current - failsafeStep);
+                throttleRamp.retarget(rampTarget, rampTarget);
+                int throttleValue = int(rampTarget + 0.5);
+                if (throttleRamp.applied != throttleValue) {
+                    throttle.setPulseWidth(throttleValue);
+                    throttleRamp.applied = throttleValue;
+                }
+            }
+            continue;
+        }
+        if (now - command->postedAt > deadlineMs) {
+            // too old to apply, hold the outputs until the next command or the failsafe
+            staleCommands.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        if (failsafeActive.load(memory_order_relaxed)) {
+            failsafeActive.store(false, memory_order_relaxed);
+            // ramp from where the failsafe left the outputs
+            lastCommand = nullopt;
+        }
+
+        if (!lastCommand.has_value() || lastCommand->postedAt != command->postedAt ||
+            lastCommand->steering != command->steering || lastCommand->throttle != command->throttle) {
+            lastCommand = command;
+            rampStart = now;
+            steeringRamp.retarget(command->steering, steeringRamp.applied.value_or(command->steering));
+            throttleRamp.retarget(command->throttle, throttleRamp.applied.value_or(command->throttle));
+        }
+        double progress = interpolationMs > 0 ? min(1.0, double(now - rampStart) / interpolationMs) : 1.0;
+
+        int steeringValue = int(steeringRamp.at(progress) + 0.5);
+        if (steeringRamp.applied != steeringValue) {
+            steering.setPulseWidth(steeringValue);
+            steeringRamp.applied = steeringValue;
+        }
+        int throttleValue = int(throttleRamp.at(progress) + 0.5);
+        if (throttleRamp.applied != throttleValue) {
+            throttle.setPulseWidth(throttleValue);
+            throttleRamp.applied = throttleValue;
+        }
+    }
+}
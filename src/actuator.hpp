@@ -0,0 +1,113 @@
+#ifndef actuator_hpp
+#define actuator_hpp
+
+#include "servo.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <thread>
+
+/// Latest control command, overwritten by every new one
+///
+/// The command is packed into one 64-bit atomic, so writers on network threads
+/// and the actuator thread never wait for each other.
+class ControlMailbox {
+public:
+    struct Command {
+        /// Pulse widths in microseconds
+        int steering;
+        int throttle;
+        /// Steady clock time the command was posted, in milliseconds modulo 2^32
+        uint32_t postedAt;
+    };
+
+    /// Shortest and longest pulse widths a command may set, in microseconds
+    static constexpr int minPulseWidth = 500;
+    static constexpr int maxPulseWidth = 2500;
+
+    /// Posts a command, fields without value keep their latest value
+    ///
+    /// Pulse widths are clamped to [minPulseWidth, maxPulseWidth].
+    void post(std::optional<int> steering, std::optional<int> throttle);
+
+    /// Returns the latest command, nullopt if none was posted yet
+    std::optional<Command> latest() const;
+
+    /// Current steady clock time in milliseconds modulo 2^32, never 0
+    static uint32_t now();
+
+private:
+    /// steering (16) | throttle (16) | postedAt (32), 0 if empty
+    std::atomic<uint64_t> slot = 0;
+};
+
+/// Applies the latest control command to the servos from a dedicated thread
+///
+/// The thread wakes up at a fixed period, independently of how commands arrive,
+/// and moves the outputs linearly from their current value to a new command
+/// over one command interval.
+///
+/// A command older than commandDeadline is not applied, the outputs hold. If no
+/// command arrives for failsafeTimeout, the throttle ramps down to neutral while
+/// steering holds its position, until the next command.
+class ActuatorThread {
+public:
+    struct Config {
+        /// Output update period
+        std::chrono::microseconds period = std::chrono::milliseconds(5);
+        /// Duration over which a new command is interpolated, the sending interval of the client
+        std::chrono::milliseconds interpolation = std::chrono::milliseconds(20);
+        /// Commands older than this are not applied
+        std::chrono::milliseconds commandDeadline = std::chrono::milliseconds(100);
+        /// Silence after which the failsafe ramps the throttle to neutral
+        std::chrono::milliseconds failsafeTimeout = std::chrono::milliseconds(150);
+        /// Duration of the failsafe ramp from full range to neutral
+        std::chrono::milliseconds failsafeRamp = std::chrono::milliseconds(300);
+        /// Neutral throttle pulse width
+        int neutralThrottle = 1500;
+        /// SCHED_FIFO priority, 0 to keep the default scheduling
+        int priority = 50;
+    };
+
+    struct Stats {
+        /// Periods where the thread woke up after the next period had started
+        uint64_t missedDeadlines = 0;
+        /// Periods where the latest command was older than commandDeadline
+        uint64_t staleCommands = 0;
+        /// Number of times the failsafe engaged
+        uint64_t failsafeEvents = 0;
+        /// True while no command arrived for failsafeTimeout
+        bool failsafeActive = false;
+    };
+
+    ActuatorThread(ControlMailbox &mailbox, ServoOutput &steering, ServoOutput &throttle, Config config);
+    ActuatorThread(ControlMailbox &mailbox, ServoOutput &steering, ServoOutput &throttle);
+    ~ActuatorThread();
+
+    void start();
+    void stop();
+
+    Stats stats() const;
+
+    // Deleted operations
+    ActuatorThread(const ActuatorThread &rhs) = delete;
+    ActuatorThread &operator=(const ActuatorThread &rhs) = delete;
+
+private:
+    ControlMailbox &mailbox;
+    ServoOutput &steering;
+    ServoOutput &throttle;
+    const Config config;
+    std::atomic<bool> quit = false;
+    std::atomic<uint64_t> missedDeadlines = 0;
+    std::atomic<uint64_t> staleCommands = 0;
+    std::atomic<uint64_t> failsafeEvents = 0;
+    std::atomic<bool> failsafeActive = false;
+    std::thread thread;
+
+    void actuatorThreadHandler();
+};
+
+#endif /* actuator_hpp */
@@ -0,0 +1,212 @@
+#include "audiocapture.hpp"
+#include "helpers.hpp"
+
+#include <alsa/asoundlib.h>
+#include <opus.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+/// Number of periods in the ALSA ring buffer, kept small for latency
+static const snd_pcm_uframes_t alsaPeriods = 4;
+/// Largest Opus frame we produce
+static const size_t maxOpusFrameSize = 1276;
+
+AlsaAudioSource::AlsaAudioSource(const string &device, unsigned channels, size_t periodFrames)
+    : channelCount(channels) {
+    int err = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+    if (err < 0) {
+        throw runtime_error("Unable to open ALSA device " + device + ": " + snd_strerror(err));
+    }
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_malloc(&params);
+    snd_pcm_uframes_t periodSize = periodFrames;
+    snd_pcm_uframes_t bufferSize = periodFrames * alsaPeriods;
+    if ((err = snd_pcm_hw_params_any(pcm, params)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(pcm, params, channels)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate(pcm, params, AudioCapture::sampleRate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size_near(pcm, params, &periodSize, nullptr)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_size_near(pcm, params, &bufferSize)) < 0 ||
+        (err = snd_pcm_hw_params(pcm, params)) < 0) {
+        snd_pcm_hw_params_free(params);
+        snd_pcm_close(pcm);
+        throw runtime_error("Unable to configure ALSA device " + device + ": " + snd_strerror(err));
+    }
+    snd_pcm_hw_params_free(params);
+    std::cout << "ALSA capture " << device << ": period " << periodSize << ", buffer " << bufferSize << " frames" << std::endl;
+}
+
+AlsaAudioSource::~AlsaAudioSource() {
+    snd_pcm_close(pcm);
+}
+
+unsigned AlsaAudioSource::channels() const {
+    return channelCount;
+}
+
+optional<uint64_t> AlsaAudioSource::read(int16_t *buffer, size_t frames) {
+    size_t done = 0;
+    while (done < frames) {
+        snd_pcm_sframes_t result = snd_pcm_readi(pcm, buffer + done * channelCount, frames - done);
+        if (result < 0) {
+            // overrun, drop what we have and start again
+            if (snd_pcm_recover(pcm, int(result), 1) < 0) {
+                std::cout << "ALSA read failed: " << snd_strerror(int(result)) << std::endl;
+                return nullopt;
+            }
+            done = 0;
+            continue;
+        }
+        done += size_t(result);
+    }
+    // frames still in the ring buffer were captured after ours
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0 || delay < 0) {
+        delay = 0;
+    }
+    uint64_t age = (uint64_t(frames) + uint64_t(delay)) * 1000 * 1000 / AudioCapture::sampleRate;
+    return currentTimeInMicroSeconds() - age;
+}
+
+static uint32_t readLittleEndian(const char *data, size_t size) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= uint32_t(uint8_t(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+WavAudioSource::WavAudioSource(const string &path) : file(path, ios::binary) {
+    char header[12];
+    if (!file.read(header, sizeof(header)) || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        throw runtime_error("Not a WAV file: " + path);
+    }
+    bool hasFormat = false;
+    char chunk[8];
+    while (file.read(chunk, sizeof(chunk))) {
+        uint32_t chunkSize = readLittleEndian(chunk + 4, 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+            char format[16];
+            file.read(format, sizeof(format));
+            file.seekg(chunkSize - sizeof(format) + (chunkSize & 1), ios::cur);
+            uint32_t audioFormat = readLittleEndian(format, 2);
+            channelCount = readLittleEndian(format + 2, 2);
+            uint32_t rate = readLittleEndian(format + 4, 4);
+            uint32_t bitsPerSample = readLittleEndian(format + 14, 2);
+            if (audioFormat != 1 || bitsPerSample != 16 || rate != AudioCapture::sampleRate ||
+                channelCount < 1 || channelCount > 2) {
+                throw runtime_error("Unsupported WAV format, expected 16-bit PCM at 48kHz: " + path);
+            }
+            hasFormat = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!hasFormat) {
+                break;
+            }
+            dataStart = file.tellg();
+            dataLength = chunkSize / (2 * channelCount);
+            if (dataLength == 0) {
+                break;
+            }
+            return;
+        } else {
+            file.seekg(chunkSize + (chunkSize & 1), ios::cur);
+        }
+    }
+    throw runtime_error("Missing WAV audio data: " + path);
+}
+
+unsigned WavAudioSource::channels() const {
+    return channelCount;
+}
+
+optional<uint64_t> WavAudioSource::read(int16_t *pcm, size_t frames) {
+    // pace the file like a capture device would
+    uint64_t duration = uint64_t(frames) * 1000 * 1000 / AudioCapture::sampleRate;
+    if (!nextFrameTime.has_value()) {
+        nextFrameTime = currentTimeInMicroSeconds() + duration;
+    }
+    uint64_t now = currentTimeInMicroSeconds();
+    if (nextFrameTime.value() > now) {
+        std::this_thread::sleep_for(std::chrono::microseconds(nextFrameTime.value() - now));
+    }
+    uint64_t captureTime = nextFrameTime.value() - duration;
+    nextFrameTime = nextFrameTime.value() + duration;
+
+    size_t done = 0;
+    while (done < frames) {
+        if (dataPosition == dataLength) {
+            file.clear();
+            file.seekg(dataStart);
+            dataPosition = 0;
+        }
+        size_t count = std::min(frames - done, dataLength - dataPosition);
+        if (!file.read(reinterpret_cast<char *>(pcm + done * channelCount), count * 2 * channelCount)) {
+            return nullopt;
+        }
+        dataPosition += count;
+        done += count;
+    }
+    return captureTime;
+}
+
+unique_ptr<AudioSource> makeAudioSource(const string &name) {
+    const string wavSuffix = ".wav";
+    if (name.size() >= wavSuffix.size() && name.compare(name.size() - wavSuffix.size(), wavSuffix.size(), wavSuffix) == 0) {
+        return make_unique<WavAudioSource>(name);
+    }
+    return make_unique<AlsaAudioSource>(name, 1, AudioCapture::frameSize);
+}
+
+AudioCapture::AudioCapture(unique_ptr<AudioSource> source, on_frame_cb onFrame, int bitrate)
+    : source(std::move(source)), onFrame(std::move(onFrame)) {
+    int err = OPUS_OK;
+    encoder = opus_encoder_create(sampleRate, int(this->source->channels()), OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err);
+    if (err != OPUS_OK) {
+        throw runtime_error(string("Unable to create Opus encoder: ") + opus_strerror(err));
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+    // keep encoding cheap on single core boards
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(3));
+}
+
+AudioCapture::~AudioCapture() {
+    stop();
+    opus_encoder_destroy(encoder);
+}
+
+void AudioCapture::start() {
+    quit = false;
+    thread = std::thread(&AudioCapture::captureThreadHandler, this);
+}
+
+void AudioCapture::stop() {
+    quit = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void AudioCapture::captureThreadHandler() {
+    vector<int16_t> pcm(frameSize * source->channels());
+    byte packet[maxOpusFrameSize];
+    while (!quit) {
+        auto captureTime = source->read(pcm.data(), frameSize);
+        if (!captureTime.has_value()) {
+            break;
+        }
+        auto size = opus_encode(encoder, pcm.data(), int(frameSize), reinterpret_cast<unsigned char *>(packet),
+                                int(sizeof(packet)));
+        if (size < 0) {
+            std::cout << "Opus encoding failed: " << opus_strerror(size) << std::endl;
+            continue;
+        }
+        onFrame(packet, size_t(size), captureTime.value());
+    }
+}
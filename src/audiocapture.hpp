@@ -0,0 +1,103 @@
+#ifndef audiocapture_hpp
+#define audiocapture_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Source of interleaved signed 16-bit PCM at AudioCapture::sampleRate
+class AudioSource {
+public:
+    virtual ~AudioSource() = default;
+
+    virtual unsigned channels() const = 0;
+
+    /// Blocks until given number of frames are read
+    /// @param pcm Buffer for frames * channels() samples
+    /// @param frames Number of frames to read
+    /// @returns Wall clock capture time of the first frame in microseconds, nullopt on failure
+    virtual std::optional<uint64_t> read(int16_t *pcm, size_t frames) = 0;
+};
+
+/// ALSA capture device opened with small periods
+class AlsaAudioSource final : public AudioSource {
+public:
+    /// @param device ALSA device name, e.g. "hw:1,0"
+    /// @param channels Number of channels
+    /// @param periodFrames Period size in frames
+    AlsaAudioSource(const std::string &device, unsigned channels, size_t periodFrames);
+    ~AlsaAudioSource();
+
+    unsigned channels() const override;
+    std::optional<uint64_t> read(int16_t *pcm, size_t frames) override;
+
+private:
+    struct _snd_pcm *pcm = nullptr;
+    unsigned channelCount;
+};
+
+/// 16-bit PCM WAV file played in real time and looped, stands in for a capture device
+class WavAudioSource final : public AudioSource {
+public:
+    /// @param path Path of the WAV file
+    WavAudioSource(const std::string &path);
+
+    unsigned channels() const override;
+    std::optional<uint64_t> read(int16_t *pcm, size_t frames) override;
+
+private:
+    std::ifstream file;
+    unsigned channelCount = 0;
+    std::streampos dataStart;
+    size_t dataLength = 0;
+    size_t dataPosition = 0;
+    std::optional<uint64_t> nextFrameTime = std::nullopt;
+};
+
+/// Creates a WAV source for paths ending with ".wav", an ALSA source otherwise
+std::unique_ptr<AudioSource> makeAudioSource(const std::string &name);
+
+/// Captures audio on its own thread and encodes it to Opus
+class AudioCapture {
+public:
+    /// Opus and WebRTC sample rate
+    static const unsigned sampleRate = 48000;
+    /// Duration of one Opus frame, also used as capture period
+    static const unsigned frameDurationMs = 10;
+    static const size_t frameSize = sampleRate * frameDurationMs / 1000;
+    static const int defaultBitrate = 32000;
+
+    /// Called on the capture thread for every encoded frame
+    /// @param data Opus frame
+    /// @param size Size of the frame
+    /// @param captureTime Wall clock capture time of the first sample in microseconds
+    typedef std::function<void(const std::byte *data, size_t size, uint64_t captureTime)> on_frame_cb;
+
+    AudioCapture(std::unique_ptr<AudioSource> source, on_frame_cb onFrame, int bitrate = defaultBitrate);
+    ~AudioCapture();
+
+    void start();
+    void stop();
+
+    // Deleted operations
+    AudioCapture(const AudioCapture &rhs) = delete;
+    AudioCapture &operator=(const AudioCapture &rhs) = delete;
+
+private:
+    std::unique_ptr<AudioSource> source;
+    on_frame_cb onFrame;
+    struct OpusEncoder *encoder = nullptr;
+    std::atomic<bool> quit = false;
+    std::thread thread;
+
+    void captureThreadHandler();
+};
+
+#endif /* audiocapture_hpp */
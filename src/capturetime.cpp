@@ -0,0 +1,72 @@
+#include "capturetime.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+using namespace std;
+using namespace rtc;
+
+const std::string RtpCaptureTimeExtension::uri = "http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time";
+
+/// profile of RFC 8285 one-byte header extensions
+static const uint16_t oneByteHeaderProfile = 0xBEDE;
+/// one-byte element header and 8 bytes of timestamp, padded to 32 bits
+static const size_t elementSize = 12;
+
+RtpCaptureTimeExtension::RtpCaptureTimeExtension(uint8_t id) : MediaHandlerElement(), id(id) {}
+
+void RtpCaptureTimeExtension::setCaptureTime(uint64_t ntpTimestamp) {
+    captureTime.store(ntpTimestamp, std::memory_order_relaxed);
+}
+
+ChainedOutgoingProduct RtpCaptureTimeExtension::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                                             message_ptr control) {
+    auto ntpTimestamp = captureTime.load(std::memory_order_relaxed);
+    if (ntpTimestamp != 0) {
+        for (const auto &message : *messages) {
+            addExtension(*message, ntpTimestamp);
+        }
+    }
+    return {messages, control};
+}
+
+void RtpCaptureTimeExtension::addExtension(binary &packet, uint64_t ntpTimestamp) {
+    if (packet.size() < sizeof(RtpHeader)) {
+        return;
+    }
+    auto rtp = reinterpret_cast<RtpHeader *>(packet.data());
+    size_t offset = rtp->getSize();
+    bool hasExtension = rtp->extension();
+    if (hasExtension) {
+        auto header = rtp->getExtensionHeader();
+        if (header->profileSpecificId() != oneByteHeaderProfile) {
+            return;
+        }
+        // append the element after the existing ones, zero bytes are padding
+        offset += rtp->getExtensionHeaderSize();
+    }
+    if (offset > packet.size()) {
+        return;
+    }
+
+    // room for the extension header when the packet has none yet
+    byte data[sizeof(RtpExtensionHeader) + elementSize] = {};
+    size_t headerSize = hasExtension ? 0 : sizeof(RtpExtensionHeader);
+    byte *element = data + headerSize;
+    element[0] = byte((id << 4) | (sizeof(uint64_t) - 1));
+    for (int i = 0; i < 8; i++) {
+        element[1 + i] = byte(ntpTimestamp >> (56 - 8 * i));
+    }
+    packet.insert(packet.begin() + offset, data, data + headerSize + elementSize);
+
+    rtp = reinterpret_cast<RtpHeader *>(packet.data());
+    if (!hasExtension) {
+        rtp->setExtension(true);
+        rtp->getExtensionHeader()->setProfileSpecificId(oneByteHeaderProfile);
+    }
+    auto header = rtp->getExtensionHeader();
+    header->setHeaderLength((hasExtension ? header->headerLength() : 0) + elementSize / 4);
+}
@@ -0,0 +1,39 @@
+#ifndef capturetime_hpp
+#define capturetime_hpp
+
+#include "rtc/rtc.hpp"
+
+#include <atomic>
+
+/// Media handler element adding the abs-capture-time RTP header extension
+///
+/// The capture time of the frame being sent is set with setCaptureTime() right
+/// before Track::send(), every packet of that frame then carries it.
+class RtpCaptureTimeExtension final : public rtc::MediaHandlerElement {
+public:
+    static const std::string uri;
+    static const uint8_t defaultId = 3;
+
+    /// Extension ID as negotiated in SDP (1-14)
+    const uint8_t id;
+
+    RtpCaptureTimeExtension(uint8_t id = defaultId);
+
+    /// Set capture time of next sent frame
+    /// @param ntpTimestamp Capture time as 64-bit NTP timestamp, 0 to disable the extension
+    void setCaptureTime(uint64_t ntpTimestamp);
+
+    /// Writes the extension into every outgoing RTP packet
+    /// @param messages RTP packets
+    /// @param control RTCP
+    /// @returns Extended RTP packets and unchanged RTCP
+    rtc::ChainedOutgoingProduct processOutgoingBinaryMessage(rtc::ChainedMessagesProduct messages,
+                                                             rtc::message_ptr control) override;
+
+private:
+    std::atomic<uint64_t> captureTime = 0;
+
+    void addExtension(rtc::binary &packet, uint64_t ntpTimestamp);
+};
+
+#endif /* capturetime_hpp */
@@ -0,0 +1,102 @@
+#include "clientregistry.hpp"
+
+using namespace std;
+
+namespace {
+
+void addReadyTrack(ReadyTracks &ready, const optional<shared_ptr<ClientTrackData>> &trackData) {
+    if (!trackData.has_value()) {
+        return;
+    }
+    auto &data = trackData.value();
+    ready.tracks.push_back({data->track.get(), data->sender->rtpConfig.get(), data->sender.get(),
+                            data->captureTime.get(), data->epoch});
+    ready.owners.push_back(data);
+}
+
+} // namespace
+
+ClientRegistry::ClientRegistry()
+    : current(make_shared<const Map>()), video(make_shared<const ReadyTracks>()),
+      audio(make_shared<const ReadyTracks>()) {}
+
+ClientRegistry::Snapshot ClientRegistry::snapshot() const {
+    lock_guard<mutex> lock(publishMutex);
+    return current;
+}
+
+shared_ptr<Client> ClientRegistry::find(const string &id) const {
+    auto clients = snapshot();
+    auto it = clients->find(id);
+    return it != clients->end() ? it->second : nullptr;
+}
+
+void ClientRegistry::emplace(const string &id, shared_ptr<Client> client) {
+    lock_guard<mutex> lock(writeMutex);
+    auto updated = make_shared<Map>(*current);
+    (*updated)[id] = std::move(client);
+    Snapshot previous = std::move(updated);
+    {
+        lock_guard<mutex> lock(publishMutex);
+        current.swap(previous);
+    }
+}
+
+bool ClientRegistry::erase(const string &id) {
+    lock_guard<mutex> lock(writeMutex);
+    if (current->find(id) == current->end()) {
+        return false;
+    }
+    auto updated = make_shared<Map>(*current);
+    updated->erase(id);
+    Snapshot previous = std::move(updated);
+    {
+        lock_guard<mutex> lock(publishMutex);
+        current.swap(previous);
+    }
+    rebuildReady();
+    return true;
+}
+
+const ReadyTracks &ClientRegistry::readyVideo(ReadyTracksCache &cache) const {
+    return load(video, cache);
+}
+
+const ReadyTracks &ClientRegistry::readyAudio(ReadyTracksCache &cache) const {
+    return load(audio, cache);
+}
+
+const ReadyTracks &ClientRegistry::load(const shared_ptr<const ReadyTracks> &tracks, ReadyTracksCache &cache) const {
+    if (readyGeneration.load(memory_order_acquire) != cache.generation) {
+        lock_guard<mutex> lock(publishMutex);
+        cache.tracks = tracks;
+        cache.generation = readyGeneration.load(memory_order_relaxed);
+    }
+    return *cache.tracks;
+}
+
+void ClientRegistry::updateReady() {
+    lock_guard<mutex> lock(writeMutex);
+    rebuildReady();
+}
+
+void ClientRegistry::rebuildReady() {
+    auto readyVideo = make_shared<ReadyTracks>();
+    auto readyAudio = make_shared<ReadyTracks>();
+    for (const auto &id_client: *current) {
+        const auto &client = id_client.second;
+        if (client->getState() == Client::State::Ready) {
+            addReadyTrack(*readyVideo, client->video);
+            addReadyTrack(*readyAudio, client->audio);
+        }
+    }
+    shared_ptr<const ReadyTracks> previousVideo = std::move(readyVideo);
+    shared_ptr<const ReadyTracks> previousAudio = std::move(readyAudio);
+    {
+        lock_guard<mutex> lock(publishMutex);
+        video.swap(previousVideo);
+        audio.swap(previousAudio);
+        readyGeneration.fetch_add(1, memory_order_release);
+    }
+    // the old arrays are freed here, or by the last reader holding them
+}
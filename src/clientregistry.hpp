@@ -0,0 +1,102 @@
+#ifndef clientregistry_hpp
+#define clientregistry_hpp
+
+#include "helpers.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Pointers to what the fan-out of a frame needs from one ready track
+struct ReadyTrack {
+    rtc::Track *track;
+    rtc::RtpPacketizationConfig *rtpConfig;
+    rtc::RtcpSrReporter *sender;
+    /// nullptr if the track has no abs-capture-time extension
+    RtpCaptureTimeExtension *captureTime;
+    /// See ClientTrackData::epoch
+    uint64_t epoch;
+};
+
+/// Contiguous array of the tracks of ready clients
+struct ReadyTracks {
+    std::vector<ReadyTrack> tracks;
+    /// Keeps the objects pointed to by tracks alive
+    std::vector<std::shared_ptr<ClientTrackData>> owners;
+};
+
+/// Ready tracks cached by one reader thread, see ClientRegistry::readyVideo()
+struct ReadyTracksCache {
+    /// Generation of tracks, 0 before the first load
+    uint64_t generation = 0;
+    std::shared_ptr<const ReadyTracks> tracks;
+};
+
+/// Connected clients, safe to use from any thread
+///
+/// Readers take an immutable snapshot of the map and iterate it without any
+/// lock held. Writers copy the map, modify the copy and publish it; a snapshot
+/// stays valid for as long as a reader holds it, even if the client is removed
+/// meanwhile. Taking a snapshot locks a mutex that writers only hold to swap
+/// pointers. The camera and audio threads keep their ready tracks in a cache
+/// and only take it when a generation counter shows that the tracks changed,
+/// so a frame costs them one atomic load.
+class ClientRegistry {
+public:
+    typedef std::unordered_map<std::string, std::shared_ptr<Client>> Map;
+    typedef std::shared_ptr<const Map> Snapshot;
+
+    ClientRegistry();
+
+    /// Returns the current clients, to be iterated by const reference
+    Snapshot snapshot() const;
+
+    /// Returns the client with given ID, nullptr if there is none
+    std::shared_ptr<Client> find(const std::string &id) const;
+
+    /// Adds a client, replacing the one with the same ID
+    void emplace(const std::string &id, std::shared_ptr<Client> client);
+
+    /// Removes a client
+    /// @returns True if the client was registered
+    bool erase(const std::string &id);
+
+    /// Returns the video tracks of the clients that were ready at the last update
+    /// @param cache Cache of the calling thread, reloaded if the tracks changed
+    /// @returns Tracks, valid until the next call with the same cache
+    const ReadyTracks &readyVideo(ReadyTracksCache &cache) const;
+
+    /// Returns the audio tracks of the clients that were ready at the last update
+    /// @param cache Cache of the calling thread, reloaded if the tracks changed
+    /// @returns Tracks, valid until the next call with the same cache
+    const ReadyTracks &readyAudio(ReadyTracksCache &cache) const;
+
+    /// Rebuilds the ready track arrays, to be called after a client state change
+    void updateReady();
+
+    ClientRegistry(const ClientRegistry &) = delete;
+    ClientRegistry &operator=(const ClientRegistry &) = delete;
+
+private:
+    /// Serializes writers, readers never take it
+    std::mutex writeMutex;
+    /// Guards the pointers below, held only to copy or swap them
+    mutable std::mutex publishMutex;
+    Snapshot current;
+    std::shared_ptr<const ReadyTracks> video;
+    std::shared_ptr<const ReadyTracks> audio;
+    /// Incremented under publishMutex whenever video and audio are replaced
+    std::atomic<uint64_t> readyGeneration = 1;
+
+    /// Rebuilds the ready track arrays, writeMutex must be held
+    void rebuildReady();
+
+    /// Reloads cache from tracks if readyGeneration changed
+    const ReadyTracks &load(const std::shared_ptr<const ReadyTracks> &tracks, ReadyTracksCache &cache) const;
+};
+
+#endif /* clientregistry_hpp */
@@ -0,0 +1,74 @@
+#include "controllease.hpp"
+
+using namespace std;
+
+ControlLease::ControlLease(chrono::milliseconds timeout) : timeout(timeout) {}
+
+bool ControlLease::request(const string &id) {
+    unique_lock<std::mutex> lock(mutex);
+    auto now = chrono::steady_clock::now();
+    if (currentHolder == id) {
+        lastRenewal = now;
+        return true;
+    }
+    if (currentHolder.has_value() && now - lastRenewal < timeout) {
+        return false;
+    }
+    // free, or the holder stopped sending: hand over
+    currentHolder = id;
+    lastRenewal = now;
+    lock.unlock();
+    notify(id);
+    return true;
+}
+
+void ControlLease::release(const string &id) {
+    unique_lock<std::mutex> lock(mutex);
+    if (currentHolder != id) {
+        return;
+    }
+    currentHolder = nullopt;
+    lock.unlock();
+    notify(nullopt);
+}
+
+bool ControlLease::renew(const string &id) {
+    lock_guard<std::mutex> lock(mutex);
+    if (currentHolder != id) {
+        return false;
+    }
+    lastRenewal = chrono::steady_clock::now();
+    return true;
+}
+
+bool ControlLease::expire() {
+    unique_lock<std::mutex> lock(mutex);
+    if (!currentHolder.has_value() || chrono::steady_clock::now() - lastRenewal < timeout) {
+        return false;
+    }
+    currentHolder = nullopt;
+    lock.unlock();
+    notify(nullopt);
+    return true;
+}
+
+optional<string> ControlLease::holder() {
+    lock_guard<std::mutex> lock(mutex);
+    return currentHolder;
+}
+
+void ControlLease::onChange(on_change_cb callback) {
+    lock_guard<std::mutex> lock(mutex);
+    changeCallback = std::move(callback);
+}
+
+void ControlLease::notify(optional<string> holder) {
+    on_change_cb callback;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        callback = changeCallback;
+    }
+    if (callback) {
+        callback(std::move(holder));
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef controllease_hpp
+#define controllease_hpp
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+
+/// Single driving token shared by the connected peers
+///
+/// Only the holder's control frames reach the servos, every other peer is a
+/// spectator. Control frames of the holder are its heartbeat: when they stop
+/// for longer than the timeout, any peer may take the lease over, and expire()
+/// frees it so spectators learn that they can drive.
+class ControlLease {
+public:
+    /// Called with the new holder, nullopt when the lease is free
+    typedef std::function<void(std::optional<std::string> holder)> on_change_cb;
+
+    ControlLease(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+    /// Grants the lease if it is free, expired or already held by the peer
+    /// @param id Client ID
+    /// @returns True if the peer holds the lease
+    bool request(const std::string &id);
+
+    /// Releases the lease if the peer holds it
+    void release(const std::string &id);
+
+    /// Renews the lease of the holder, to be called for every control frame
+    /// @returns True if the peer holds the lease and its command may be applied
+    bool renew(const std::string &id);
+
+    /// Frees the lease if its holder stopped renewing it, to be called periodically
+    /// @returns True if the lease was freed
+    bool expire();
+
+    /// Returns the current holder, even if its lease expired
+    std::optional<std::string> holder();
+
+    /// Sets the callback for holder changes, called without the lock held
+    void onChange(on_change_cb callback);
+
+    ControlLease(const ControlLease &) = delete;
+    ControlLease &operator=(const ControlLease &) = delete;
+
+private:
+    const std::chrono::milliseconds timeout;
+    std::mutex mutex;
+    std::optional<std::string> currentHolder = std::nullopt;
+    std::chrono::steady_clock::time_point lastRenewal;
+    on_change_cb changeCallback = nullptr;
+
+    void notify(std::optional<std::string> holder);
+};
+
+#endif /* controllease_hpp */
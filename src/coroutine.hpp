@@ -0,0 +1,143 @@
+#ifndef coroutine_hpp
+#define coroutine_hpp
+
+#include "dispatchqueue.hpp"
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/// Fire-and-forget coroutine, started on a DispatchQueue
+///
+/// The coroutine is created suspended and runs on the queue once started. Its
+/// frame is freed when it returns, an exception escaping it is logged.
+class Async {
+public:
+    struct promise_type {
+        Async get_return_object() {
+            return Async(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            try {
+                std::rethrow_exception(std::current_exception());
+            } catch (const std::exception &e) {
+                std::cout << "Coroutine failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cout << "Coroutine failed: unknown exception" << std::endl;
+            }
+        }
+    };
+
+    Async(Async &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    ~Async() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /// Runs the coroutine on queue until its first suspension point
+    void start(DispatchQueue &queue) && {
+        queue.dispatch([handle = std::exchange(handle, nullptr)]() { handle.resume(); });
+    }
+
+    // Deleted operations
+    Async(const Async &) = delete;
+    Async &operator=(const Async &) = delete;
+
+private:
+    explicit Async(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/// Values pushed from any thread, awaited by one coroutine
+///
+/// Turns a callback such as PeerConnection::onStateChange into something a
+/// coroutine can co_await. The waiting coroutine is resumed on the queue given
+/// at construction, so everything it does runs on that thread.
+template <typename T> class AsyncChannel {
+public:
+    AsyncChannel(DispatchQueue &queue) : queue(queue) {}
+
+    /// Hands a value to the waiting coroutine, or keeps it for the next receive()
+    void push(T value) {
+        std::unique_lock lock(mutex);
+        if (closed) {
+            return;
+        }
+        if (waiter) {
+            *waiterValue = std::move(value);
+            resume(lock);
+            return;
+        }
+        values.push_back(std::move(value));
+    }
+
+    /// Ends the stream, receive() returns nullopt once the pushed values are consumed
+    void close() {
+        std::unique_lock lock(mutex);
+        closed = true;
+        if (waiter) {
+            resume(lock);
+        }
+    }
+
+    /// Awaitable returning the next value, nullopt if the channel is closed
+    auto receive() {
+        struct Awaiter {
+            AsyncChannel &channel;
+            std::optional<T> value = std::nullopt;
+
+            bool await_ready() { return false; }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                std::lock_guard lock(channel.mutex);
+                if (!channel.values.empty()) {
+                    value = std::move(channel.values.front());
+                    channel.values.pop_front();
+                    return false;
+                }
+                if (channel.closed) {
+                    return false;
+                }
+                channel.waiter = handle;
+                channel.waiterValue = &value;
+                return true;
+            }
+
+            std::optional<T> await_resume() { return std::move(value); }
+        };
+        return Awaiter{*this};
+    }
+
+    // Deleted operations
+    AsyncChannel(const AsyncChannel &) = delete;
+    AsyncChannel &operator=(const AsyncChannel &) = delete;
+
+private:
+    DispatchQueue &queue;
+    std::mutex mutex;
+    std::deque<T> values;
+    bool closed = false;
+    /// Coroutine suspended in receive(), and where its value goes
+    std::coroutine_handle<> waiter = nullptr;
+    std::optional<T> *waiterValue = nullptr;
+
+    void resume(std::unique_lock<std::mutex> &lock) {
+        auto handle = std::exchange(waiter, nullptr);
+        waiterValue = nullptr;
+        lock.unlock();
+        queue.dispatch([handle]() { handle.resume(); });
+    }
+};
+
+#endif /* coroutine_hpp */
@@ -10,8 +10,129 @@
 
 #include "dispatchqueue.hpp"
 
-DispatchQueue::DispatchQueue(std::string name, size_t threadCount) :
-    name{std::move(name)}, threads(threadCount) {
+#include <algorithm>
+#include <climits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected, const timespec *timeout) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> *word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/// Queue whose task the calling thread runs, nullptr outside of dispatch threads
+thread_local const DispatchQueue *currentQueue = nullptr;
+
+} // namespace
+
+TaskRing::TaskRing(size_t capacity) : mask(roundUpToPowerOfTwo(capacity) - 1), cells(new Cell[mask + 1]) {
+    for (size_t i = 0; i <= mask; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool TaskRing::tryPush(Task &task, Deadline deadline) {
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t difference = intptr_t(sequence) - intptr_t(position);
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.task = std::move(task);
+                cell.deadline = deadline;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool TaskRing::tryPop(Task &task, Deadline *deadline) {
+    size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+        if (difference == 0) {
+            if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                task = std::move(cell.task);
+                if (deadline) {
+                    *deadline = cell.deadline;
+                }
+                cell.sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = dequeuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void ThreadParking::notify(int count) {
+    // sleepers is read after wakeups is incremented, so a thread that is about to
+    // sleep either sees the new work in its last check or gets a stale ticket
+    wakeups.fetch_add(1);
+    if (sleepers.load() > 0) {
+        futexWake(&wakeups, count);
+    }
+}
+
+void ThreadParking::notifyAll() {
+    wakeups.fetch_add(1);
+    futexWake(&wakeups, INT_MAX);
+}
+
+uint32_t ThreadParking::prepare() {
+    sleepers.fetch_add(1);
+    return wakeups.load();
+}
+
+void ThreadParking::wait(uint32_t ticket, std::optional<std::chrono::nanoseconds> timeout) {
+    if (timeout.has_value()) {
+        auto nanoseconds = std::max<int64_t>(timeout->count(), 0);
+        timespec relative = {time_t(nanoseconds / 1000000000), long(nanoseconds % 1000000000)};
+        futexWait(&wakeups, ticket, &relative);
+    } else {
+        futexWait(&wakeups, ticket, nullptr);
+    }
+    sleepers.fetch_sub(1);
+}
+
+void ThreadParking::cancel() {
+    sleepers.fetch_sub(1);
+}
+
+bool ThreadParking::hasSleepers() const {
+    return sleepers.load() > 0;
+}
+
+DispatchQueue::DispatchQueue(std::string name, size_t threadCount, size_t capacity) :
+    name{std::move(name)}, nextTimer(INT64_MAX), threads(threadCount) {
+    for (auto &ring: rings) {
+        ring = std::make_unique<TaskRing>(capacity);
+    }
     for(size_t i = 0; i < threads.size(); i++)
     {
         threads[i] = std::thread(&DispatchQueue::dispatchThreadHandler, this);
@@ -20,10 +141,8 @@ DispatchQueue::DispatchQueue(std::string name, size_t threadCount) :
 
 DispatchQueue::~DispatchQueue() {
     // Signal to dispatch threads that it's time to wrap up
-    std::unique_lock<std::mutex> lock(lockMutex);
-    quit = true;
-    lock.unlock();
-    condition.notify_all();
+    quit.store(true);
+    parking.notifyAll();
 
     // Wait for threads to finish before we exit
     for(size_t i = 0; i < threads.size(); i++)
@@ -33,53 +152,170 @@ DispatchQueue::~DispatchQueue() {
             threads[i].join();
         }
     }
+    removePending();
 }
 
 void DispatchQueue::removePending() {
-    std::unique_lock<std::mutex> lock(lockMutex);
-    queue = {};
+    Task task;
+    for (auto &ring: rings) {
+        while (ring->tryPop(task)) {
+            task.reset();
+        }
+    }
+    for (auto &overflow: overflows) {
+        std::lock_guard lock(overflow.mutex);
+        overflow.tasks.clear();
+        overflow.size.store(0);
+    }
+    std::vector<Timer> removed;
+    {
+        std::lock_guard lock(timerMutex);
+        removed.swap(timers);
+        nextTimer.store(INT64_MAX);
+    }
 }
 
-void DispatchQueue::dispatch(const fp_t& op) {
-    std::unique_lock<std::mutex> lock(lockMutex);
-    queue.push(op);
+uint64_t DispatchQueue::expiredCount() const {
+    return expired.load(std::memory_order_relaxed);
+}
 
-    // Manual unlocking is done before notifying, to avoid waking up
-    // the waiting thread only to block again (see notify_one for details)
-    lock.unlock();
-    condition.notify_one();
+void DispatchQueue::dispatch(Task &&task, Priority priority, Clock::time_point deadline) {
+    TaskRing &ring = *rings[size_t(priority)];
+    Overflow &overflow = overflows[size_t(priority)];
+    // queue behind the overflowed tasks to keep the order
+    while (overflow.size.load(std::memory_order_acquire) != 0 || !ring.tryPush(task, deadline)) {
+        if (currentQueue == this || overflow.size.load(std::memory_order_acquire) != 0) {
+            // a single threaded queue would never make room while its thread waits here
+            pushOverflow(priority, task, deadline);
+            break;
+        }
+        // full, let the threads catch up
+        std::this_thread::yield();
+    }
+    parking.notify();
 }
 
-void DispatchQueue::dispatch(fp_t&& op) {
-    std::unique_lock<std::mutex> lock(lockMutex);
-    queue.push(std::move(op));
+void DispatchQueue::pushOverflow(Priority priority, Task &task, Clock::time_point deadline) {
+    Overflow &overflow = overflows[size_t(priority)];
+    std::lock_guard lock(overflow.mutex);
+    overflow.tasks.emplace_back(std::move(task), deadline);
+    overflow.size.fetch_add(1, std::memory_order_release);
+}
 
-    // Manual unlocking is done before notifying, to avoid waking up
-    // the waiting thread only to block again (see notify_one for details)
-    lock.unlock();
-    condition.notify_one();
+bool DispatchQueue::popOverflow(Overflow &overflow, Task &task, Clock::time_point &deadline) {
+    if (overflow.size.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard lock(overflow.mutex);
+    if (overflow.tasks.empty()) {
+        return false;
+    }
+    task = std::move(overflow.tasks.front().first);
+    deadline = overflow.tasks.front().second;
+    overflow.tasks.pop_front();
+    overflow.size.fetch_sub(1, std::memory_order_release);
+    return true;
 }
 
-void DispatchQueue::dispatchThreadHandler(void) {
-    std::unique_lock<std::mutex> lock(lockMutex);
-    do {
-        //Wait until we have data or a quit signal
-        condition.wait(lock, [this]{
-            return (queue.size() || quit);
-        });
-
-        //after wait, we own the lock
-        if(!quit && queue.size())
-        {
-            auto op = std::move(queue.front());
-            queue.pop();
+bool DispatchQueue::laterTimer(const Timer &a, const Timer &b) {
+    return a.due > b.due;
+}
+
+void DispatchQueue::dispatchAfter(Clock::duration delay, Task &&task, Priority priority) {
+    auto due = Clock::now() + delay;
+    bool first;
+    {
+        std::lock_guard lock(timerMutex);
+        timers.push_back(Timer{due, priority, std::move(task)});
+        std::push_heap(timers.begin(), timers.end(), laterTimer);
+        first = timers.front().due == due;
+        nextTimer.store(timers.front().due.time_since_epoch().count());
+    }
+    // a sleeping thread may wait for a later timer
+    if (first) {
+        parking.notifyAll();
+    }
+}
+
+void DispatchQueue::fireTimers() {
+    auto now = Clock::now();
+    if (now.time_since_epoch().count() < nextTimer.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::vector<Timer> due;
+    {
+        std::lock_guard lock(timerMutex);
+        while (!timers.empty() && timers.front().due <= now) {
+            std::pop_heap(timers.begin(), timers.end(), laterTimer);
+            due.push_back(std::move(timers.back()));
+            timers.pop_back();
+        }
+        nextTimer.store(timers.empty() ? INT64_MAX : timers.front().due.time_since_epoch().count());
+    }
+    for (auto &timer: due) {
+        // waiting for room from a dispatch thread could wait forever
+        if (overflows[size_t(timer.priority)].size.load(std::memory_order_acquire) != 0 ||
+            !rings[size_t(timer.priority)]->tryPush(timer.task)) {
+            pushOverflow(timer.priority, timer.task, Clock::time_point::max());
+        }
+    }
+    if (!due.empty()) {
+        parking.notify(int(due.size()));
+    }
+}
 
-            //unlock now that we're done messing with the queue
-            lock.unlock();
+std::optional<std::chrono::nanoseconds> DispatchQueue::timeUntilNextTimer() const {
+    int64_t next = nextTimer.load();
+    if (next == INT64_MAX) {
+        return std::nullopt;
+    }
+    return std::chrono::nanoseconds(next - Clock::now().time_since_epoch().count());
+}
 
-            op();
+bool DispatchQueue::popNext(Task &task) {
+    for (size_t i = 0; i < priorityCount; i++) {
+        Clock::time_point deadline;
+        // the ring holds the older tasks
+        while (rings[i]->tryPop(task, &deadline) || popOverflow(overflows[i], task, deadline)) {
+            if (deadline == Clock::time_point::max() || Clock::now() <= deadline) {
+                return true;
+            }
+            task.reset();
+            expired.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return false;
+}
 
-            lock.lock();
+void DispatchQueue::dispatchThreadHandler(void) {
+    currentQueue = this;
+    int idle = 0;
+    while (!quit.load(std::memory_order_relaxed)) {
+        fireTimers();
+        // one task at a time, so that a realtime task never waits behind a batch
+        Task task;
+        if (popNext(task)) {
+            idle = 0;
+            task();
+            continue;
+        }
+        if (++idle < spinCount) {
+            std::this_thread::yield();
+            continue;
         }
-    } while (!quit);
+
+        // announce we sleep before the last check, see ThreadParking::notify()
+        uint32_t ticket = parking.prepare();
+        if (popNext(task)) {
+            parking.cancel();
+            task();
+            continue;
+        }
+        if (!quit.load()) {
+            parking.wait(ticket, timeUntilNextTimer());
+        } else {
+            parking.cancel();
+        }
+        idle = 0;
+    }
 }
@@ -10,26 +10,256 @@
 #ifndef dispatchqueue_hpp
 #define dispatchqueue_hpp
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <condition_variable>
-#include <queue>
-#include <functional>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-class DispatchQueue {
-    typedef std::function<void(void)> fp_t;
+/// Move-only callable, stored inline when small enough
+class Task {
+public:
+    /// Captures up to this size are stored without allocating, small enough for
+    /// a TaskRing cell with its sequence and deadline to fit in 64 bytes
+    static constexpr size_t inlineSize = 40;
+    /// Alignment of the inline storage, over-aligned captures are allocated
+    static constexpr size_t inlineAlignment = 8;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F &&function) {
+        typedef std::decay_t<F> Stored;
+        if constexpr (sizeof(Stored) <= inlineSize && alignof(Stored) <= inlineAlignment &&
+                      std::is_nothrow_move_constructible_v<Stored>) {
+            new (&storage) Stored(std::forward<F>(function));
+            operations = &inlineOperations<Stored>;
+        } else {
+            *reinterpret_cast<Stored **>(&storage) = new Stored(std::forward<F>(function));
+            operations = &heapOperations<Stored>;
+        }
+    }
+
+    Task(Task &&other) noexcept {
+        moveFrom(other);
+    }
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        reset();
+    }
+
+    explicit operator bool() const {
+        return operations != nullptr;
+    }
+
+    void operator()() {
+        operations->invoke(&storage);
+    }
+
+    void reset() {
+        if (operations) {
+            operations->destroy(&storage);
+            operations = nullptr;
+        }
+    }
+
+    // Deleted operations
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
 
+private:
+    struct Operations {
+        void (*invoke)(void *storage);
+        /// Move constructs into destination and destroys the source
+        void (*relocate)(void *destination, void *source);
+        void (*destroy)(void *storage);
+    };
+
+    template <typename Stored> static constexpr Operations inlineOperations = {
+        [](void *storage) { (*static_cast<Stored *>(storage))(); },
+        [](void *destination, void *source) {
+            new (destination) Stored(std::move(*static_cast<Stored *>(source)));
+            static_cast<Stored *>(source)->~Stored();
+        },
+        [](void *storage) { static_cast<Stored *>(storage)->~Stored(); },
+    };
+
+    template <typename Stored> static constexpr Operations heapOperations = {
+        [](void *storage) { (**static_cast<Stored **>(storage))(); },
+        [](void *destination, void *source) {
+            *static_cast<Stored **>(destination) = *static_cast<Stored **>(source);
+        },
+        [](void *storage) { delete *static_cast<Stored **>(storage); },
+    };
+
+    std::aligned_storage_t<inlineSize, inlineAlignment> storage;
+    const Operations *operations = nullptr;
+
+    void moveFrom(Task &other) {
+        if (other.operations) {
+            other.operations->relocate(&storage, &other.storage);
+            operations = other.operations;
+            other.operations = nullptr;
+        }
+    }
+};
+
+/// Bounded lock-free ring of tasks for any number of producers and consumers
+///
+/// Vyukov MPMC queue: every cell carries a sequence number telling whether it is
+/// free for the producer of a given position or holds the task for the consumer
+/// of that position, so pushing and popping take one CAS and no lock.
+class TaskRing {
 public:
-    DispatchQueue(std::string name, size_t threadCount = 1);
+    typedef std::chrono::steady_clock::time_point Deadline;
+
+    /// @param capacity Number of tasks, rounded up to a power of two
+    TaskRing(size_t capacity);
+
+    /// Moves the task into the ring
+    /// @param task Task
+    /// @param deadline Returned with the task by tryPop()
+    /// @returns False if the ring is full, task is left untouched
+    bool tryPush(Task &task, Deadline deadline = Deadline::max());
+
+    /// Moves the oldest task out of the ring
+    /// @param task Task
+    /// @param deadline Set to the deadline of the task if not nullptr
+    /// @returns False if the ring is empty
+    bool tryPop(Task &task, Deadline *deadline = nullptr);
+
+    // Deleted operations
+    TaskRing(const TaskRing &) = delete;
+    TaskRing &operator=(const TaskRing &) = delete;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> sequence;
+        Deadline deadline;
+        Task task;
+    };
+    static_assert(sizeof(Cell) == 64, "a cell should take one cache line");
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueuePosition = 0;
+    alignas(64) std::atomic<size_t> dequeuePosition = 0;
+};
+
+/// Lets threads of a pool sleep on a futex until work is published
+///
+/// A thread calls prepare(), checks for work once more, then wait() or cancel().
+/// Publishers call notify() after making work visible, which only enters the
+/// kernel when a thread sleeps.
+class ThreadParking {
+public:
+    /// Wakes up to count sleeping threads
+    void notify(int count = 1);
+    void notifyAll();
+
+    /// Announces that the calling thread is going to sleep
+    /// @returns Ticket for wait()
+    uint32_t prepare();
+
+    /// Sleeps until notified since prepare() returned the ticket
+    /// @param ticket Value returned by prepare()
+    /// @param timeout Longest time to sleep, forever if not set
+    void wait(uint32_t ticket, std::optional<std::chrono::nanoseconds> timeout = std::nullopt);
+
+    /// Gives up sleeping after prepare(), when work was found
+    void cancel();
+
+    bool hasSleepers() const;
+
+private:
+    /// Incremented by every notification, threads sleep on it
+    alignas(64) std::atomic<uint32_t> wakeups = 0;
+    std::atomic<uint32_t> sleepers = 0;
+};
+
+/// Runs tasks on a pool of threads, in FIFO order per priority when it has a single thread
+///
+/// Every priority has its own TaskRing, so dispatching takes no lock and small
+/// lambdas are not allocated. Threads always run the most urgent task first and
+/// drop tasks whose deadline passed before they started. Idle threads spin
+/// briefly and then sleep on a futex, until the next task or timer.
+///
+/// A task that finds its ring full waits for room, unless it is dispatched from
+/// a thread of the queue, which may be the only one able to make room. It then
+/// goes to an unbounded overflow list, and later tasks of that priority queue
+/// behind it until the list is drained.
+class DispatchQueue {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Priority {
+        /// Control loop, runs before anything else
+        Realtime,
+        /// Media setup and signaling
+        Media,
+        /// Stats, cleanup and other maintenance
+        Housekeeping,
+    };
+    static const size_t priorityCount = 3;
+
+    /// Default number of tasks the ring of each priority can hold
+    static const size_t defaultCapacity = 1024;
+    /// Failed dequeues before a thread goes to sleep
+    static const int spinCount = 100;
+
+    /// @param name Queue name, for debugging
+    /// @param threadCount Number of threads running tasks
+    /// @param capacity Capacity of each ring, rounded up to a power of two
+    DispatchQueue(std::string name, size_t threadCount = 1, size_t capacity = defaultCapacity);
     ~DispatchQueue();
 
-    // dispatch and copy
-    void dispatch(const fp_t& op);
-    // dispatch and move
-    void dispatch(fp_t&& op);
+    /// Queues a callable, waiting for room while the ring is full, see above
+    /// @param task Task
+    /// @param priority Ring the task is queued on
+    /// @param deadline The task is dropped if it has not started by then
+    void dispatch(Task &&task, Priority priority = Priority::Media,
+                  Clock::time_point deadline = Clock::time_point::max());
+
+    template <typename F>
+    void dispatch(F &&function, Priority priority = Priority::Media,
+                  Clock::time_point deadline = Clock::time_point::max()) {
+        dispatch(Task(std::forward<F>(function)), priority, deadline);
+    }
+
+    /// Queues a callable once delay has elapsed, from the threads of the queue
+    /// @param delay Time to wait
+    /// @param task Task
+    /// @param priority Ring the task is queued on when due
+    void dispatchAfter(Clock::duration delay, Task &&task, Priority priority = Priority::Media);
 
+    template <typename F>
+    void dispatchAfter(Clock::duration delay, F &&function, Priority priority = Priority::Media) {
+        dispatchAfter(delay, Task(std::forward<F>(function)), priority);
+    }
+
+    /// Drops the tasks that have not started yet, and the timers
     void removePending();
 
+    /// Number of tasks dropped because their deadline passed
+    uint64_t expiredCount() const;
+
     // Deleted operations
     DispatchQueue(const DispatchQueue& rhs) = delete;
     DispatchQueue& operator=(const DispatchQueue& rhs) = delete;
@@ -37,12 +267,46 @@ public:
     DispatchQueue& operator=(DispatchQueue&& rhs) = delete;
 
 private:
+    struct Timer {
+        Clock::time_point due;
+        Priority priority;
+        Task task;
+    };
+
+    /// Tasks of one priority that did not fit in its ring
+    struct Overflow {
+        std::mutex mutex;
+        std::deque<std::pair<Task, Clock::time_point>> tasks;
+        /// Size of tasks, read without the mutex
+        std::atomic<size_t> size = 0;
+    };
+
+    /// Heap order of timers, earliest at the front
+    static bool laterTimer(const Timer &a, const Timer &b);
+
     std::string name;
-    std::mutex lockMutex;
+    std::unique_ptr<TaskRing> rings[priorityCount];
+    Overflow overflows[priorityCount];
+    ThreadParking parking;
+    std::atomic<uint64_t> expired = 0;
+    /// Min-heap on due time, only touched by timer operations
+    std::mutex timerMutex;
+    std::vector<Timer> timers;
+    /// Due time of the first timer in nanoseconds since the clock epoch, max if none
+    std::atomic<int64_t> nextTimer;
+    std::atomic<bool> quit = false;
     std::vector<std::thread> threads;
-    std::queue<fp_t> queue;
-    std::condition_variable condition;
-    bool quit = false;
+
+    /// Appends a task to the overflow list of its priority
+    void pushOverflow(Priority priority, Task &task, Clock::time_point deadline);
+    /// Moves the oldest task out of an overflow list
+    bool popOverflow(Overflow &overflow, Task &task, Clock::time_point &deadline);
+    /// Pops the most urgent task that is not expired
+    bool popNext(Task &task);
+    /// Queues the timers that are due
+    void fireTimers();
+    /// Time until the next timer, if any
+    std::optional<std::chrono::nanoseconds> timeUntilNextTimer() const;
 
     void dispatchThreadHandler(void);
 };
@@ -56,9 +56,11 @@ int gettimeofday(struct timeval *tv, struct timezone *tz) {
 using namespace std;
 using namespace rtc;
 
-ClientTrackData::ClientTrackData(shared_ptr<Track> track, shared_ptr<RtcpSrReporter> sender) {
+ClientTrackData::ClientTrackData(shared_ptr<Track> track, shared_ptr<RtcpSrReporter> sender,
+                                 shared_ptr<RtcpStatsReporter> stats) {
 	this->track = track;
 	this->sender = sender;
+	this->stats = stats;
 }
 
 void Client::setState(State state) {
@@ -81,3 +83,11 @@ uint64_t currentTimeInMicroSeconds() {
 	gettimeofday(&time, NULL);
 	return uint64_t(time.tv_sec) * 1000 * 1000 + time.tv_usec;
 }
+
+uint64_t toNtpTimestamp(uint64_t timeInMicroSeconds) {
+	// number of seconds between 1900 (NTP epoch) and 1970
+	const uint64_t ntpEpochOffset = 2208988800ULL;
+	uint64_t seconds = timeInMicroSeconds / (1000 * 1000) + ntpEpochOffset;
+	uint64_t fraction = ((timeInMicroSeconds % (1000 * 1000)) << 32) / (1000 * 1000);
+	return (seconds << 32) | fraction;
+}
@@ -11,14 +11,21 @@
 #define helpers_hpp
 
 #include "rtc/rtc.hpp"
+#include "rtcpstats.hpp"
+#include "capturetime.hpp"
 
 #include <shared_mutex>
 
 struct ClientTrackData {
     std::shared_ptr<rtc::Track> track;
     std::shared_ptr<rtc::RtcpSrReporter> sender;
+    std::shared_ptr<RtcpStatsReporter> stats;
+    std::shared_ptr<RtpCaptureTimeExtension> captureTime = nullptr;
+    /// Wall clock time in microseconds at RTP timestamp startTimestamp, the same for all tracks of a client
+    uint64_t epoch = 0;
 
-    ClientTrackData(std::shared_ptr<rtc::Track> track, std::shared_ptr<rtc::RtcpSrReporter> sender);
+    ClientTrackData(std::shared_ptr<rtc::Track> track, std::shared_ptr<rtc::RtcpSrReporter> sender,
+                    std::shared_ptr<RtcpStatsReporter> stats);
 };
 
 struct Client {
@@ -34,7 +41,10 @@ struct Client {
     }
     std::optional<std::shared_ptr<ClientTrackData>> video;
     std::optional<std::shared_ptr<ClientTrackData>> audio;
+    /// Reliable channel for configuration and reports
     std::optional<std::shared_ptr<rtc::DataChannel>> dataChannel;
+    /// Unordered channel without retransmissions for control frames
+    std::optional<std::shared_ptr<rtc::DataChannel>> controlChannel;
 
     void setState(State state);
     State getState();
@@ -56,4 +66,7 @@ struct ClientTrack {
 
 uint64_t currentTimeInMicroSeconds();
 
+/// Converts a wall clock time in microseconds to a 64-bit NTP timestamp (UQ32.32)
+uint64_t toNtpTimestamp(uint64_t timeInMicroSeconds);
+
 #endif /* helpers_hpp */
@@ -1,13 +1,25 @@
 #include "nlohmann/json.hpp"
 
 #include "helpers.hpp"
+#include "clientregistry.hpp"
 #include "ArgParser.hpp"
 #include "dispatchqueue.hpp"
-#include <pigpio.h>
+#include "threadpool.hpp"
+#include "coroutine.hpp"
+#include "udpbatch.hpp"
+#include "srtpprofile.hpp"
+#include "messagecodec.hpp"
+#include "actuator.hpp"
+#include "controllease.hpp"
+#if ENABLE_AUDIO
+#include "audiocapture.hpp"
+#endif
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <random>
 #include <iostream>
+#include <fstream>
 #include <memory>
 #include <thread>
 #include <unordered_map>
@@ -18,6 +30,7 @@ extern "C" {
     #include "viewfinder.h"
     int start_mmalcam(on_buffer_cb cb);
     void request_i_frame();
+    int get_stc_time(uint64_t *time);
 }
 #ifdef _WIN32
 #include <winsock2.h>
@@ -35,7 +48,7 @@ using json = nlohmann::json;
 template <class T> weak_ptr<T> make_weak_ptr(shared_ptr<T> ptr) { return ptr; }
 
 /// all connected clients
-unordered_map<string, shared_ptr<Client>> clients{};
+ClientRegistry clients;
 
 /// Creates peer connection and client representation
 /// @param config Configuration
@@ -51,8 +64,31 @@ shared_ptr<Client> createPeerConnection(const Configuration &config,
 /// @param adding_video True if adding video
 void addToStream(shared_ptr<Client> client, bool isAddingVideo);
 
+/// Handles the signaling messages of a WebSocket until it closes
+/// @param config Configuration of new peer connections
+/// @param ws WebSocket
+/// @param messages Text messages received on the WebSocket
+Async serveSignaling(Configuration config, shared_ptr<WebSocket> ws, shared_ptr<AsyncChannel<string>> messages);
+
+/// Follows the state of a peer connection until it goes away
+/// @param id Client ID
+/// @param states States of the peer connection
+/// @param gathering Closed when the peer goes away
+Async watchPeer(string id, shared_ptr<AsyncChannel<PeerConnection::State>> states,
+                shared_ptr<AsyncChannel<PeerConnection::GatheringState>> gathering);
+
+/// Logs ICE gathering progress of a peer connection
+/// @param gathering Gathering states of the peer connection
+Async watchGathering(shared_ptr<AsyncChannel<PeerConnection::GatheringState>> gathering);
+
+void handleJsonMessage(const string &id, shared_ptr<Client> client, const string &msg);
+
+void sendLeaseState(const string &id, shared_ptr<Client> client, optional<string> holder);
+
 /// Main dispatch queue
 DispatchQueue MainThread("Main");
+/// Runs the signaling coroutines, a single thread so negotiation needs no lock
+DispatchQueue SignalingLoop("Signaling");
 
 const string defaultIPAddress = "0.0.0.0";
 const uint16_t defaultPort = 8000;
@@ -63,6 +99,11 @@ void sendInitialNalus(shared_ptr<ClientTrackData> video, uint32_t timestamp);
 uint32_t last_frame_timestamp = 0;
 uint32_t last_frame_duration = 0;
 
+/// Wall clock minus camera STC, in microseconds
+int64_t stc_offset = 0;
+uint64_t last_stc_sync = 0;
+const uint64_t stcSyncInterval = 1000 * 1000;
+
 std::byte* s_buf = static_cast<std::byte*>(malloc(65554));
 size_t s_buf_length = 0;
 size_t s_data_length = 0;
@@ -74,39 +115,106 @@ std::byte* start_ptr;
 
 bool pending_frame = false;
 
+/// Core the camera thread is pinned to when the fan-out runs on the pool
+const int cameraCore = 0;
+/// Cores of the video fan-out threads, empty to send from the camera thread
+vector<int> fanoutCores = WorkStealingPool::defaultCores();
+/// Sends the frame of each peer from its own core, nullptr if fanoutCores is empty
+std::unique_ptr<WorkStealingPool> fanoutPool;
+/// Scheduling of the camera, encoder and camcorder threads
+ThreadScheduling cameraScheduling = {SCHED_OTHER, 0};
+
+/// Packetizes, encrypts and sends the current frame to one peer
+/// @param sink Video track of the peer
+/// @param captureTime Wall clock capture time in microseconds
+/// @param captureNtp Capture time for abs-capture-time, 0 if unknown
+void sendVideoFrame(const ReadyTrack &sink, uint64_t captureTime, uint64_t captureNtp);
+
 std::string localId;
 
 int run_websocket_server();
 
-class GPIO {
-    private:
-    int _pin = 0;
-    public:
-    GPIO(int pin) {
-        _pin = pin;
-        gpioSetMode(pin, PI_OUTPUT);
-    }
-
-    ~GPIO() {}
-
-    int servo(int pwm) {
-        return gpioServo(_pin, pwm);
-    }
-    
-};
-
-GPIO *bldc, *steer;
+/// SRTP profiles to negotiate, most preferred first, device default if not set
+std::optional<vector<string>> srtpProfiles = std::nullopt;
+
+/// ALSA capture device or WAV file for the audio track
+std::optional<string> audioSource = std::nullopt;
+void on_audio_frame(const std::byte *data, size_t size, uint64_t captureTime);
+
+/// Path of the periodic JSON stats dump, "-" for stdout
+std::optional<string> statsPath = std::nullopt;
+const auto statsInterval = 1s;
+void scheduleStatsDump();
+/// Frees the control lease of a peer that stopped driving, see ControlLease::expire()
+void scheduleLeaseExpiry();
+/// Period of the lease expiry check
+const auto leaseCheckInterval = 250ms;
+
+/// Latest control command, applied to the servos by the actuator thread
+ControlMailbox controlMailbox;
+/// Driving token, only its holder's commands reach the mailbox
+ControlLease controlLease;
+/// Actuator thread settings, including the control link failsafe
+ActuatorThread::Config actuatorConfig;
+/// Servo backend, see makeServoOutputs()
+string servoBackend = defaultServoBackend;
 
 int main(int argc, char **argv) try {
     bool enableDebugLogs = false;
     bool printHelp = false;
     int c = 0;
-    auto parser = ArgParser({{"a", "audio"}, {"b", "video"}, {"d", "ip"}, {"p","port"}}, {{"h", "help"}, {"v", "verbose"}});
+    auto parser = ArgParser({{"a", "audio"}, {"b", "video"}, {"d", "ip"}, {"e", "srtp"}, {"f", "failsafe"}, {"g", "servo"}, {"p","port"}, {"r", "realtime"}, {"s", "stats"}, {"w", "workers"}}, {{"h", "help"}, {"u", "udp-batch"}, {"v", "verbose"}});
     auto parsingResult = parser.parse(argc, argv, [](string key, string value) {
         if (key == "ip") {
             ip_address = value;
         } else if (key == "port") {
             port = atoi(value.data());
+        } else if (key == "stats") {
+            statsPath = value;
+        } else if (key == "audio") {
+            audioSource = value;
+        } else if (key == "servo") {
+            servoBackend = value;
+        } else if (key == "workers") {
+            try {
+                fanoutCores = WorkStealingPool::parseCores(value);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return false;
+            }
+        } else if (key == "realtime") {
+            try {
+                cameraScheduling = ThreadScheduling::parse(value);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return false;
+            }
+        } else if (key == "failsafe") {
+            size_t end = 0;
+            int timeout = -1;
+            try {
+                timeout = stoi(value, &end);
+            } catch (const std::exception &) {
+            }
+            // a timeout shorter than the command deadline fires between fresh commands
+            if (end != value.size() || std::chrono::milliseconds(timeout) < actuatorConfig.commandDeadline) {
+                cerr << "Invalid failsafe timeout " << value << ", the minimum is " << actuatorConfig.commandDeadline.count() << " ms" << endl;
+                return false;
+            }
+            actuatorConfig.failsafeTimeout = std::chrono::milliseconds(timeout);
+        } else if (key == "srtp") {
+            auto profiles = SrtpProfiles::parse(value);
+            for (auto &profile: profiles) {
+                if (find(SrtpProfiles::supported.begin(), SrtpProfiles::supported.end(), profile) == SrtpProfiles::supported.end()) {
+                    cerr << "Unsupported SRTP profile " << profile << endl;
+                    return false;
+                }
+            }
+            if (profiles.empty()) {
+                cerr << "No SRTP profile given" << endl;
+                return false;
+            }
+            srtpProfiles = profiles;
         } else {
             cerr << "Invalid option --" << key << " with value " << value << endl;
             return false;
@@ -117,6 +225,8 @@ int main(int argc, char **argv) try {
             enableDebugLogs = true;
         } else if (flag == "help") {
             printHelp = true;
+        } else if (flag == "udp-batch") {
+            UdpSendBatch::setEnabled(true);
         } else {
             cerr << "Invalid flag --" << flag << endl;
             return false;
@@ -128,31 +238,87 @@ int main(int argc, char **argv) try {
     }
 
     if (printHelp) {
-        cout << "usage: stream-h264 [-a opus_samples_folder] [-b h264_samples_folder] [-d ip_address] [-p port] [-v] [-h]" << endl
+        cout << "usage: stream-h264 [-a audio_device] [-b h264_samples_folder] [-d ip_address] [-e srtp_profiles] [-f failsafe_ms] [-g servo_backend] [-p port] [-r policy:priority] [-s stats_file] [-u] [-v] [-w cores] [-h]" << endl
         << "Arguments:" << endl
+        << "\t -a " << "ALSA capture device, or 16-bit 48kHz WAV file, for the Opus audio track." << endl
         << "\t -d " << "Signaling server IP address (default: " << defaultIPAddress << ")." << endl
+        << "\t -e " << "Colon separated SRTP profiles, most preferred first (default: cheapest for this CPU)." << endl
+        << "\t -f " << "Ramp the throttle to neutral after this many milliseconds without control (default: " << actuatorConfig.failsafeTimeout.count() << ")." << endl
+        << "\t -g " << "Servo backend: pigpio, sysfs (hardware PWM) or sim (default: " << defaultServoBackend << ")." << endl
         << "\t -p " << "Signaling server port (default: " << defaultPort << ")." << endl
+        << "\t -r " << "Run the camera threads with fifo:<priority> or rr:<priority> real-time scheduling (default: none)." << endl
+        << "\t -s " << "Dump per-peer RTCP stats and dispatch queue counters as JSON to this file every second (\"-\" for stdout)." << endl
+        << "\t -u " << "Batch the UDP sends of each frame with sendmmsg/GSO." << endl
         << "\t -v " << "Enable debug logs." << endl
+        << "\t -w " << "Comma separated cores to send video from, \"none\" to send from the camera thread (default: all but core " << cameraCore << ")." << endl
         << "\t -h " << "Print this help and exit." << endl;
         return 0;
     }
     if (enableDebugLogs) {
         InitLogger(LogLevel::Debug);
     }
+#if !ENABLE_AUDIO
+    if (audioSource.has_value()) {
+        cerr << "Built without audio support (ALSA and opus are required)" << endl;
+        return 1;
+    }
+#endif
 
-    std::thread websocket_thread(run_websocket_server);
-    if (gpioInitialise() >= 0) {
-        std::cout << "GPIO working" << std::endl;
-        bldc = new GPIO(12);
-        bldc->servo(1500);
+    // fail before any thread starts, a car that cannot steer must not look like it runs
+    ServoOutputs servos;
+    try {
+        servos = makeServoOutputs(servoBackend);
+        std::cout << "Servo backend: " << servoBackend << std::endl;
+    } catch (const std::exception &e) {
+        cerr << e.what() << ", use -g sim to run without servos" << endl;
+        terminateServoBackends();
+        return 1;
+    }
 
-        steer = new GPIO(13);
-        steer->servo(1500);
-    } 
+    controlLease.onChange([](optional<string> holder) {
+        std::cout << "Control lease: " << holder.value_or("free") << std::endl;
+        MainThread.dispatch([]() {
+            // changes racing on other threads may arrive in any order, send the latest
+            auto holder = controlLease.holder();
+            auto snapshot = clients.snapshot();
+            for (const auto &id_client: *snapshot) {
+                sendLeaseState(id_client.first, id_client.second, holder);
+            }
+        }, DispatchQueue::Priority::Media);
+    });
+    scheduleLeaseExpiry();
 
-    std::thread mmalcam_thread(start_mmalcam, &on_mmalcam_buffer);
+    std::thread websocket_thread(run_websocket_server);
+    if (statsPath.has_value()) {
+        scheduleStatsDump();
+    }
+#if ENABLE_AUDIO
+    std::unique_ptr<AudioCapture> audio_capture;
+    if (audioSource.has_value()) {
+        audio_capture = std::make_unique<AudioCapture>(makeAudioSource(audioSource.value()), &on_audio_frame);
+        audio_capture->start();
+    }
+#endif
+    auto actuator = std::make_unique<ActuatorThread>(controlMailbox, *servos.steering, *servos.throttle, actuatorConfig);
+    actuator->start();
+
+    if (!fanoutCores.empty()) {
+        fanoutPool = std::make_unique<WorkStealingPool>("fan-out", fanoutCores);
+    }
+    std::thread mmalcam_thread([]() {
+        // the camcorder thread inherits the affinity
+        if (fanoutPool && !pinCurrentThread(cameraCore)) {
+            std::cout << "Unable to pin the camera thread to core " << cameraCore << std::endl;
+        }
+        // keep the camera and encoder callbacks off the fan-out cores too
+        mmalcam_set_scheduling(cameraScheduling.policy, cameraScheduling.priority, fanoutPool ? 1u << cameraCore : 0);
+        start_mmalcam(&on_mmalcam_buffer);
+    });
     mmalcam_thread.join();
-    gpioTerminate();
+    actuator->stop();
+    servos = {};
+    terminateServoBackends();
+    fanoutPool.reset();
     return 0;
 
 } catch (const std::exception &e) {
@@ -164,6 +330,7 @@ shared_ptr<ClientTrackData> addVideo(const shared_ptr<PeerConnection> pc, const
     auto video = Description::Video(cname);
     video.addH264Codec(payloadType);
     video.addSSRC(ssrc, cname, msid, cname);
+    video.addExtMap(Description::Entry::ExtMap(RtpCaptureTimeExtension::defaultId, RtpCaptureTimeExtension::uri));
     auto track = pc->addTrack(video);
     // create RTP configuration
     auto rtpConfig = make_shared<RtpPacketizationConfig>(ssrc, cname, payloadType, H264RtpPacketizer::defaultClockRate);
@@ -171,16 +338,50 @@ shared_ptr<ClientTrackData> addVideo(const shared_ptr<PeerConnection> pc, const
     auto packetizer = make_shared<H264RtpPacketizer>(H264RtpPacketizer::Separator::Length, rtpConfig);
     // create H264 handler
     auto h264Handler = make_shared<H264PacketizationHandler>(packetizer);
+    // add abs-capture-time header extension, before NACK handler so retransmissions keep it
+    auto captureTime = make_shared<RtpCaptureTimeExtension>();
+    h264Handler->addToChain(captureTime);
     // add RTCP SR handler
     auto srReporter = make_shared<RtcpSrReporter>(rtpConfig);
     h264Handler->addToChain(srReporter);
     // add RTCP NACK handler
     auto nackResponder = make_shared<RtcpNackResponder>();
     h264Handler->addToChain(nackResponder);
+    // add RTCP receiver report stats
+    auto statsReporter = make_shared<RtcpStatsReporter>(rtpConfig);
+    h264Handler->addToChain(statsReporter);
     // set handler
     track->setMediaHandler(h264Handler);
     track->onOpen(onOpen);
-    auto trackData = make_shared<ClientTrackData>(track, srReporter);
+    auto trackData = make_shared<ClientTrackData>(track, srReporter, statsReporter);
+    trackData->captureTime = captureTime;
+    return trackData;
+}
+
+shared_ptr<ClientTrackData> addAudio(const shared_ptr<PeerConnection> pc, const uint8_t payloadType, const uint32_t ssrc, const string cname, const string msid, const function<void (void)> onOpen) {
+    auto audio = Description::Audio(cname);
+    audio.addOpusCodec(payloadType);
+    audio.addSSRC(ssrc, cname, msid, cname);
+    auto track = pc->addTrack(audio);
+    // create RTP configuration
+    auto rtpConfig = make_shared<RtpPacketizationConfig>(ssrc, cname, payloadType, OpusRtpPacketizer::defaultClockRate);
+    // create packetizer
+    auto packetizer = make_shared<OpusRtpPacketizer>(rtpConfig);
+    // create opus handler
+    auto opusHandler = make_shared<OpusPacketizationHandler>(packetizer);
+    // add RTCP SR handler
+    auto srReporter = make_shared<RtcpSrReporter>(rtpConfig);
+    opusHandler->addToChain(srReporter);
+    // add RTCP NACK handler
+    auto nackResponder = make_shared<RtcpNackResponder>();
+    opusHandler->addToChain(nackResponder);
+    // add RTCP receiver report stats
+    auto statsReporter = make_shared<RtcpStatsReporter>(rtpConfig);
+    opusHandler->addToChain(statsReporter);
+    // set handler
+    track->setMediaHandler(opusHandler);
+    track->onOpen(onOpen);
+    auto trackData = make_shared<ClientTrackData>(track, srReporter, statsReporter);
     return trackData;
 }
 
@@ -191,36 +392,38 @@ shared_ptr<Client> createPeerConnection(const Configuration &config,
     auto pc = make_shared<PeerConnection>(config);
     auto client = make_shared<Client>(pc);
 
-    pc->onStateChange([id](PeerConnection::State state) {
-        std::cout << "State: " << state << std::endl;
-        if (state == PeerConnection::State::Disconnected ||
-            state == PeerConnection::State::Failed ||
-            state == PeerConnection::State::Closed) {
-            // remove disconnected client
-            MainThread.dispatch([id]() {
-                clients.erase(id);
-            });
-
-            bldc->servo(1500);
+    auto states = make_shared<AsyncChannel<PeerConnection::State>>(SignalingLoop);
+    pc->onStateChange([states](PeerConnection::State state) {
+        states->push(state);
+    });
+    auto gathering = make_shared<AsyncChannel<PeerConnection::GatheringState>>(SignalingLoop);
+    pc->onGatheringStateChange([gathering](PeerConnection::GatheringState state) {
+        gathering->push(state);
+    });
+    watchPeer(id, states, gathering).start(SignalingLoop);
+    watchGathering(gathering).start(SignalingLoop);
+
+    // Trickle ICE: send the offer right away, candidates follow as they are gathered
+    pc->onLocalDescription([id, wws](Description description) {
+        json message = {
+            {"id", id},
+            {"type", description.typeString()},
+            {"sdp", string(description)}
+        };
+        if (auto ws = wws.lock()) {
+            ws->send(message.dump());
         }
     });
 
-    pc->onGatheringStateChange(
-        [wpc = make_weak_ptr(pc), id, wws](PeerConnection::GatheringState state) {
-        std::cout << "Gathering State: " << state << std::endl;
-        if (state == PeerConnection::GatheringState::Complete) {
-            if(auto pc = wpc.lock()) {
-                auto description = pc->localDescription();
-                json message = {
-                    {"id", id},
-                    {"type", description->typeString()},
-                    {"sdp", string(description.value())}
-                };
-                // Gathering complete, send answer
-                if (auto ws = wws.lock()) {
-                    ws->send(message.dump());
-                }
-            }
+    pc->onLocalCandidate([id, wws](Candidate candidate) {
+        json message = {
+            {"id", id},
+            {"type", "candidate"},
+            {"candidate", candidate.candidate()},
+            {"mid", candidate.mid()}
+        };
+        if (auto ws = wws.lock()) {
+            ws->send(message.dump());
         }
     });
 
@@ -234,23 +437,63 @@ shared_ptr<Client> createPeerConnection(const Configuration &config,
         request_i_frame();
     });
 
-    auto dc = pc->createDataChannel("ping-pong");
-    dc->onOpen([id, wdc = make_weak_ptr(dc)]() {
+    if (audioSource.has_value()) {
+        client->audio = addAudio(pc, 111, 2, "audio-stream", "stream1", [id, wc = make_weak_ptr(client)]() {
+            MainThread.dispatch([wc]() {
+                if (auto c = wc.lock()) {
+                    addToStream(c, false);
+                }
+            });
+            std::cout << "Audio from " << id << " opened" << std::endl;
+        });
+    }
+    // both tracks count RTP time from here, see rtpTimestamp()
+    auto epoch = currentTimeInMicroSeconds();
+    client->video.value()->epoch = epoch;
+    if (client->audio.has_value()) {
+        client->audio.value()->epoch = epoch;
+    }
 
-    });
+    // Joystick state is resent every 20 ms, a lost frame must not hold back the next ones
+    DataChannelInit controlInit;
+    controlInit.reliability.type = Reliability::Type::Rexmit;
+    controlInit.reliability.unordered = true;
+    controlInit.reliability.rexmit = 0;
+    auto control = pc->createDataChannel("control", controlInit);
+
+    control->onMessage([id, lastSequence = std::optional<uint32_t>()](binary msg) mutable {
+        ControlFrame frame;
+        if (!parseControlFrame(msg.data(), msg.size(), frame)) {
+            return;
+        }
+        // spectators may not drive
+        if (!controlLease.renew(id)) {
+            return;
+        }
+        // frames arrive out of order, only apply newer ones (serial number arithmetic)
+        if (lastSequence.has_value() && int32_t(frame.sequence - lastSequence.value()) <= 0) {
+            return;
+        }
+        lastSequence = frame.sequence;
 
-    dc->onMessage(nullptr, [id, wdc = make_weak_ptr(dc)](string msg) {
-        nlohmann::json message = nlohmann::json::parse(msg);
+        controlMailbox.post(frame.channel(ControlFrame::Steering), frame.channel(ControlFrame::Throttle));
+    }, [id, wc = make_weak_ptr(client)](string msg) {
+        if (auto c = wc.lock()) {
+            handleJsonMessage(id, c, msg);
+        }
+    });
+    client->controlChannel = control;
 
-        auto it = message.find("x");
-        if (it != message.end()) {
-            auto x = it->get<int>();
-            steer->servo(x);
+    // Reliable and ordered, for configuration and reports
+    auto dc = pc->createDataChannel("config");
+    dc->onOpen([id, wc = make_weak_ptr(client)]() {
+        if (auto c = wc.lock()) {
+            sendLeaseState(id, c, controlLease.holder());
         }
-        it = message.find("y");
-        if (it != message.end()) {
-            auto y = it->get<int>();
-            bldc->servo(y);
+    });
+    dc->onMessage(nullptr, [id, wc = make_weak_ptr(client)](string msg) {
+        if (auto c = wc.lock()) {
+            handleJsonMessage(id, c, msg);
         }
     });
     client->dataChannel = dc;
@@ -260,12 +503,95 @@ shared_ptr<Client> createPeerConnection(const Configuration &config,
 };
 
 
+Async watchPeer(string id, shared_ptr<AsyncChannel<PeerConnection::State>> states,
+                shared_ptr<AsyncChannel<PeerConnection::GatheringState>> gathering) {
+    while (auto state = co_await states->receive()) {
+        std::cout << "State: " << state.value() << std::endl;
+        if (state == PeerConnection::State::Disconnected ||
+            state == PeerConnection::State::Failed ||
+            state == PeerConnection::State::Closed) {
+            // remove disconnected client
+            clients.erase(id);
+
+            if (controlLease.holder() == id) {
+                controlLease.release(id);
+                controlMailbox.post(std::nullopt, 1500);
+            }
+            break;
+        }
+    }
+    gathering->close();
+}
+
+Async watchGathering(shared_ptr<AsyncChannel<PeerConnection::GatheringState>> gathering) {
+    auto start = std::chrono::steady_clock::now();
+    while (auto state = co_await gathering->receive()) {
+        std::cout << "Gathering State: " << state.value() << std::endl;
+        if (state == PeerConnection::GatheringState::Complete) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "Gathering took " << elapsed.count() << " ms" << std::endl;
+            break;
+        }
+    }
+}
+
+/// Handles a JSON message from the web client
+/// @param id Client ID
+/// @param client Client
+/// @param msg Control message of an older web client, lease action or report
+void handleJsonMessage(const string &id, shared_ptr<Client> client, const string &msg) {
+    ControlMessage message;
+    if (!parseControlMessage(msg, message)) {
+        return;
+    }
+
+    if ((message.x.has_value() || message.y.has_value()) && controlLease.renew(id)) {
+        controlMailbox.post(message.x, message.y);
+    }
+    if (message.lease == "request") {
+        if (!controlLease.request(id)) {
+            // denied, tell who is driving
+            sendLeaseState(id, client, controlLease.holder());
+        }
+    } else if (message.lease == "release" && controlLease.holder() == id) {
+        controlLease.release(id);
+        controlMailbox.post(std::nullopt, 1500);
+    }
+    if (message.latency.has_value() && client->video.has_value()) {
+        client->video.value()->stats->reportLatency(message.latency.value());
+    }
+}
+
+/// Tells a client whether it drives or spectates
+/// @param id Client ID
+/// @param client Client
+/// @param holder Current lease holder
+void sendLeaseState(const string &id, shared_ptr<Client> client, optional<string> holder) {
+    if (!client->dataChannel.has_value() || !client->dataChannel.value()->isOpen()) {
+        return;
+    }
+    json message = {
+        {"lease", {
+            {"driving", holder == id},
+            {"available", !holder.has_value()}
+        }}
+    };
+    client->dataChannel.value()->send(message.dump());
+}
+
 /// Add client to stream
 /// @param client Client
 /// @param adding_video True if adding video
 void addToStream(shared_ptr<Client> client, bool isAddingVideo) {
+    if (client->audio.has_value() && client->getState() == Client::State::Waiting) {
+        // wait for the other track to open
+        client->setState(isAddingVideo ? Client::State::WaitingForAudio : Client::State::WaitingForVideo);
+        return;
+    }
     client->setState(Client::State::Ready);
     sendInitialNalus(client->video.value(), last_frame_timestamp);
+    // start sending frames once the key frame is out
+    clients.updateReady();
 }
 
 
@@ -282,6 +608,23 @@ void on_mmalcam_buffer(MMAL_BUFFER_HEADER_T* buffer) {
     last_frame_duration = buffer->pts - last_frame_timestamp;
     last_frame_timestamp = buffer->pts;
 
+    // map camera STC to wall clock for abs-capture-time
+    auto now = currentTimeInMicroSeconds();
+    if (now - last_stc_sync >= stcSyncInterval) {
+        uint64_t stc;
+        if (get_stc_time(&stc) == 0) {
+            stc_offset = int64_t(now) - int64_t(stc);
+            last_stc_sync = now;
+        }
+    }
+    uint64_t capture_ntp = 0;
+    // without a camera clock mapping, the arrival time stands in for the capture time
+    uint64_t capture_time = now;
+    if (last_stc_sync != 0 && buffer->pts != MMAL_TIME_UNKNOWN) {
+        capture_time = uint64_t(buffer->pts + stc_offset);
+        capture_ntp = toNtpTimestamp(capture_time);
+    }
+
     std::vector<H264::NaluIndex> nalu_indices = H264::FindNaluIndices(buffer->data, buffer->length);
     for (auto jt = nalu_indices.begin(); jt < nalu_indices.end(); ++jt) {
         size_t start_offset = jt->start_offset;
@@ -313,35 +656,80 @@ void on_mmalcam_buffer(MMAL_BUFFER_HEADER_T* buffer) {
     }
 
     if (!pending_frame) {
-        /** Last working copy**/
-        for(auto id_client: clients) {
-            auto id = id_client.first;
-            auto client = id_client.second;
-            auto optTrackData = client->video;
-            if (client->getState() == Client::State::Ready && optTrackData.has_value()) {
-                auto trackData = optTrackData.value();
-                auto rtpConfig = trackData->sender->rtpConfig;
-
-                // // sample time is in us, we need to convert it to seconds
-                auto elapsedSeconds = double(last_frame_duration) / (1000 * 1000);
-                // get elapsed time in clock rate
-                uint32_t elapsedTimestamp = rtpConfig->secondsToTimestamp(elapsedSeconds);
-                // set new timestamp
-                rtpConfig->timestamp = rtpConfig->startTimestamp + elapsedTimestamp - 10;
-
-                // get elapsed time in clock rate from last RTCP sender report
-                auto reportElapsedTimestamp = rtpConfig->timestamp - trackData->sender->lastReportedTimestamp();
-                // check if last report was at least 1 second ago
-                if (rtpConfig->timestampToSeconds(reportElapsedTimestamp) > 1) {
-                    trackData->sender->setNeedsToReport();
-                }
-
-                trackData->track->send(s_buf, s_buf_length);
+        // only the camera thread gets here
+        static ReadyTracksCache readyCache;
+        const auto &ready = clients.readyVideo(readyCache);
+        if (fanoutPool && ready.tracks.size() > 1) {
+            // s_buf is reused by the next frame, wait for every peer
+            WorkStealingPool::Group group;
+            for (size_t i = 0; i < ready.tracks.size(); i++) {
+                const ReadyTrack *sink = &ready.tracks[i];
+                fanoutPool->submit(group, i, [sink, capture_time, capture_ntp]() {
+                    UdpSendBatch batch;
+                    sendVideoFrame(*sink, capture_time, capture_ntp);
+                });
+            }
+            group.wait();
+        } else {
+            // flush the packets of this frame to all peers at once
+            UdpSendBatch batch;
+            for(const auto &sink: ready.tracks) {
+                sendVideoFrame(sink, capture_time, capture_ntp);
             }
         }
     }
 }
 
+/// RTP timestamp of a capture time on the timeline of the client
+///
+/// The audio and video tracks of a client share the epoch and count from the
+/// same wall clock that libdatachannel stamps sender reports with, so the peer
+/// can line them up. Capture times before the epoch wrap around, as RTP
+/// timestamps do.
+/// @param sink Track
+/// @param captureTime Wall clock capture time in microseconds
+uint32_t rtpTimestamp(const ReadyTrack &sink, uint64_t captureTime) {
+    int64_t elapsed = int64_t(captureTime - sink.epoch);
+    return sink.rtpConfig->startTimestamp + uint32_t(elapsed * int64_t(sink.rtpConfig->clockRate) / (1000 * 1000));
+}
+
+void sendVideoFrame(const ReadyTrack &sink, uint64_t captureTime, uint64_t captureNtp) {
+    auto rtpConfig = sink.rtpConfig;
+    rtpConfig->timestamp = rtpTimestamp(sink, captureTime);
+
+    // get elapsed time in clock rate from last RTCP sender report
+    auto reportElapsedTimestamp = rtpConfig->timestamp - sink.sender->lastReportedTimestamp();
+    // check if last report was at least 1 second ago
+    if (rtpConfig->timestampToSeconds(reportElapsedTimestamp) > 1) {
+        sink.sender->setNeedsToReport();
+    }
+
+    sink.captureTime->setCaptureTime(captureNtp);
+    sink.track->send(s_buf, s_buf_length);
+}
+
+/// Sends an encoded Opus frame to all ready clients
+/// @param data Opus frame
+/// @param size Size of the frame
+/// @param captureTime Wall clock capture time in microseconds
+void on_audio_frame(const std::byte *data, size_t size, uint64_t captureTime) {
+    // only the audio capture thread gets here
+    static ReadyTracksCache readyCache;
+    for(const auto &sink: clients.readyAudio(readyCache).tracks) {
+        auto rtpConfig = sink.rtpConfig;
+        rtpConfig->timestamp = rtpTimestamp(sink, captureTime);
+
+        // get elapsed time in clock rate from last RTCP sender report
+        auto reportElapsedTimestamp = rtpConfig->timestamp - sink.sender->lastReportedTimestamp();
+        // check if last report was at least 1 second ago
+        if (rtpConfig->timestampToSeconds(reportElapsedTimestamp) > 1) {
+            sink.sender->setNeedsToReport();
+        }
+
+        sink.track->send(data, size);
+    }
+}
+
 vector<byte> units{};
 vector<byte> initialNALUS() {
     units.clear();
@@ -368,6 +756,8 @@ void sendInitialNalus(shared_ptr<ClientTrackData> video, uint32_t timestamp) {
 
     // send previous NALU key frame so users don't have to wait to see stream works
     if (!initialNalus.empty()) {
+        // previous key frame, its capture time would not reflect latency
+        video->captureTime->setCaptureTime(0);
         const double frameDuration_s = double(last_frame_duration) / (1000 * 1000);
         const uint32_t frameTimestampDuration = video->sender->rtpConfig->secondsToTimestamp(frameDuration_s);
         video->sender->rtpConfig->timestamp = video->sender->rtpConfig->startTimestamp - frameTimestampDuration * 2;
@@ -377,6 +767,50 @@ void sendInitialNalus(shared_ptr<ClientTrackData> video, uint32_t timestamp) {
     }
 }
 
+/// Writes stats of all clients as a JSON object keyed by client ID, and the
+/// dispatch queue counters under "queues"
+void dumpStats() {
+    json dump = json::object();
+    auto snapshot = clients.snapshot();
+    for (const auto &id_client: *snapshot) {
+        const auto &client = id_client.second;
+        json entry = json::object();
+        if (client->video.has_value()) {
+            entry["video"] = client->video.value()->stats->stats();
+        }
+        if (client->audio.has_value()) {
+            entry["audio"] = client->audio.value()->stats->stats();
+        }
+        dump[id_client.first] = entry;
+    }
+    dump["queues"] = {{"main", {{"expired", MainThread.expiredCount()}}}};
+    if (statsPath.value() == "-") {
+        std::cout << dump.dump() << std::endl;
+        return;
+    }
+    // write then rename so readers never see a partial file
+    auto tmpPath = statsPath.value() + ".tmp";
+    std::ofstream(tmpPath) << dump.dump(4) << std::endl;
+    std::rename(tmpPath.c_str(), statsPath->c_str());
+}
+
+void scheduleStatsDump() {
+    MainThread.dispatchAfter(statsInterval, []() {
+        scheduleStatsDump();
+        // behind latency critical work, a dump is pointless once the next one is due
+        MainThread.dispatch(dumpStats, DispatchQueue::Priority::Housekeeping,
+                            DispatchQueue::Clock::now() + statsInterval);
+    }, DispatchQueue::Priority::Housekeeping);
+}
+
+void scheduleLeaseExpiry() {
+    MainThread.dispatchAfter(leaseCheckInterval, []() {
+        scheduleLeaseExpiry();
+        // notifies the peers through onChange
+        controlLease.expire();
+    }, DispatchQueue::Priority::Realtime);
+}
+
 // Helper function to generate a random ID
 std::string randomId(size_t length) {
 	using std::chrono::high_resolution_clock;
@@ -393,6 +827,9 @@ std::string randomId(size_t length) {
 int run_websocket_server() {
 	rtc::Configuration config;
     config.disableAutoNegotiation = true;
+    // rtc::Configuration has no SRTP setting, the order is applied to each DTLS handshake
+    SrtpProfiles::setPreferred(srtpProfiles.value_or(SrtpProfiles::deviceDefault()));
+    std::cout << "SRTP profiles: " << SrtpProfiles::preferred() << std::endl;
 
 	localId = randomId(4);
 	std::cout << "The local ID is " << localId << std::endl;
@@ -403,10 +840,8 @@ int run_websocket_server() {
 
     rtc::WebSocketServer server(std::move(serverConfig));
 
-    std::shared_ptr<rtc::WebSocket> client;
-    server.onClient([&config, &client](std::shared_ptr<rtc::WebSocket> incoming) {
+    server.onClient([&config](std::shared_ptr<rtc::WebSocket> client) {
 		std::cout << "WebSocketServer: Client connection received" << std::endl;
-		client = incoming;
 
 		if(auto addr = client->remoteAddress())
 			std::cout << "WebSocketServer: Client remote address is " << *addr << std::endl;
@@ -418,57 +853,75 @@ int run_websocket_server() {
 					std::cout << "WebSocketServer: Requested path is " << *path << std::endl;
 		});
 
-		client->onClosed([]() {
+		auto messages = make_shared<AsyncChannel<string>>(SignalingLoop);
+		client->onClosed([messages]() {
 			std::cout << "WebSocketServer: Client connection closed" << std::endl;
+			messages->close();
 		});
 
-		client->onMessage([&config, wclient = make_weak_ptr(client)](std::variant<rtc::binary, std::string> data) {
-            if (auto client = wclient.lock()) {
-                // data holds either std::string or rtc::binary
-                if (!std::holds_alternative<std::string>(data))
-                    return;
-
-                nlohmann::json message = nlohmann::json::parse(std::get<std::string>(data));
-
-                auto it = message.find("id");
-                if (it == message.end())
-                    return;
-
-                auto id = it->get<std::string>();
-
-                it = message.find("type");
-                if (it == message.end())
-                    return;
-
-                auto type = it->get<std::string>();
-
-                std::shared_ptr<rtc::PeerConnection> pc;
-                if (auto jt = clients.find(id); jt != clients.end()) {
-                    pc = jt->second->peerConnection;
-                    std::cout << "Found PC in clients" << std::endl;
-                } else if (type == "offer") {
-                    std::cout << "Answering to " + id << std::endl;
-                    pc = (createPeerConnection(config, wclient, id))->peerConnection;
-                } else if (type == "request") {
-                    std::cout << "Offer to " + id << std::endl;
-                    pc = (createPeerConnection(config, wclient, id))->peerConnection;
-                }
-
-                if (type == "offer" || type == "answer") {
-                    auto sdp = message["sdp"].get<std::string>();
-                    pc->setRemoteDescription(rtc::Description(sdp, type));
-                    std::cout << type << " from " << id << std::endl;
-                } else if (type == "candidate") {
-                    auto sdp = message["candidate"].get<std::string>();
-                    auto mid = message["mid"].get<std::string>();
-                    pc->addRemoteCandidate(rtc::Candidate(sdp, mid));                    
-                }
+		client->onMessage([messages](std::variant<rtc::binary, std::string> data) {
+            // data holds either std::string or rtc::binary
+            if (std::holds_alternative<std::string>(data)) {
+                messages->push(std::get<std::string>(std::move(data)));
             }
 		});
+
+		// keeps the WebSocket alive until it closes
+		serveSignaling(config, client, messages).start(SignalingLoop);
     });
     while (true) {
 	    std::this_thread::sleep_for(1s);
     }
 
 	std::cout << "Success" << std::endl;
+}
+
+Async serveSignaling(Configuration config, shared_ptr<WebSocket> ws, shared_ptr<AsyncChannel<string>> messages) {
+    weak_ptr<WebSocket> wws = ws;
+    while (auto data = co_await messages->receive()) {
+        // a bad message must not end the coroutine, it holds the WebSocket
+        try {
+            SignalingMessage message;
+            if (!parseSignalingMessage(data.value(), message)) {
+                std::cout << "Invalid signaling message" << std::endl;
+                continue;
+            }
+
+            auto id = std::string(message.id);
+            auto type = message.type;
+
+            std::shared_ptr<rtc::PeerConnection> pc;
+            if (auto existing = clients.find(id)) {
+                pc = existing->peerConnection;
+                std::cout << "Found PC in clients" << std::endl;
+            } else if (type == "offer") {
+                std::cout << "Answering to " + id << std::endl;
+                pc = (createPeerConnection(config, wws, id))->peerConnection;
+            } else if (type == "request") {
+                std::cout << "Offer to " + id << std::endl;
+                pc = (createPeerConnection(config, wws, id))->peerConnection;
+            }
+
+            if (!pc) {
+                // late candidate of a closed connection
+                continue;
+            }
+
+            if ((type == "offer" || type == "answer") && message.sdp.has_value()) {
+                auto sdp = unescapeJsonString(message.sdp.value());
+                if (!sdp.has_value())
+                    continue;
+                pc->setRemoteDescription(rtc::Description(sdp.value(), std::string(type)));
+                std::cout << type << " from " << id << std::endl;
+            } else if (type == "candidate" && message.candidate.has_value() && message.mid.has_value()) {
+                auto sdp = unescapeJsonString(message.candidate.value());
+                auto mid = unescapeJsonString(message.mid.value());
+                if (!sdp.has_value() || !mid.has_value())
+                    continue;
+                pc->addRemoteCandidate(rtc::Candidate(sdp.value(), mid.value()));
+            }
+        } catch (const std::exception &e) {
+            std::cout << "Signaling message failed: " << e.what() << std::endl;
+        }
+    }
 }
\ No newline at end of file
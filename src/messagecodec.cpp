@@ -0,0 +1,435 @@
+#include "messagecodec.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+optional<uint32_t> readHex4(string_view raw, size_t position) {
+    if (position + 4 > raw.size()) {
+        return nullopt;
+    }
+    uint32_t value = 0;
+    for (size_t i = position; i < position + 4; i++) {
+        int digit = hexValue(raw[i]);
+        if (digit < 0) {
+            return nullopt;
+        }
+        value = (value << 4) | uint32_t(digit);
+    }
+    return value;
+}
+
+void appendUtf8(string &out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+        out += char(codePoint);
+    } else if (codePoint < 0x800) {
+        out += char(0xC0 | (codePoint >> 6));
+        out += char(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += char(0xE0 | (codePoint >> 12));
+        out += char(0x80 | ((codePoint >> 6) & 0x3F));
+        out += char(0x80 | (codePoint & 0x3F));
+    } else {
+        out += char(0xF0 | (codePoint >> 18));
+        out += char(0x80 | ((codePoint >> 12) & 0x3F));
+        out += char(0x80 | ((codePoint >> 6) & 0x3F));
+        out += char(0x80 | (codePoint & 0x3F));
+    }
+}
+
+/// Accepts strings only, escaped strings are compared after unescaping
+bool stringValue(const JsonValue &value, string_view &out) {
+    if (value.type != JsonValue::Type::String) {
+        return false;
+    }
+    out = value.raw;
+    return true;
+}
+
+optional<int> intValue(const JsonValue &value) {
+    auto integer = value.asInteger();
+    if (!integer.has_value() || integer.value() < numeric_limits<int>::min() ||
+        integer.value() > numeric_limits<int>::max()) {
+        return nullopt;
+    }
+    return int(integer.value());
+}
+
+uint16_t readUint16(const byte *data) {
+    return uint16_t(uint16_t(data[0]) | uint16_t(data[1]) << 8);
+}
+
+uint32_t readUint32(const byte *data) {
+    return uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+}
+
+} // namespace
+
+optional<int64_t> JsonValue::asInteger() const {
+    if (type != Type::Number) {
+        return nullopt;
+    }
+    int64_t integer = 0;
+    auto result = from_chars(raw.data(), raw.data() + raw.size(), integer);
+    if (result.ec == errc() && result.ptr == raw.data() + raw.size()) {
+        return integer;
+    }
+    auto number = asDouble();
+    if (!number.has_value() || number.value() < double(numeric_limits<int64_t>::min()) ||
+        number.value() >= double(numeric_limits<int64_t>::max())) {
+        return nullopt;
+    }
+    return int64_t(number.value());
+}
+
+optional<double> JsonValue::asDouble() const {
+    // strtod needs a terminated string, numbers longer than this are not sent by our clients
+    char buffer[64];
+    if (type != Type::Number || raw.size() >= sizeof(buffer)) {
+        return nullopt;
+    }
+    memcpy(buffer, raw.data(), raw.size());
+    buffer[raw.size()] = '\0';
+    return strtod(buffer, nullptr);
+}
+
+optional<string_view> JsonValue::asPlainString() const {
+    if (type != Type::String || raw.find('\\') != string_view::npos) {
+        return nullopt;
+    }
+    return raw;
+}
+
+JsonObjectScanner::JsonObjectScanner(string_view input) : input(input) {
+    skipWhitespace();
+    if (!consume('{')) {
+        fail();
+    }
+}
+
+bool JsonObjectScanner::ok() const {
+    return !failed;
+}
+
+bool JsonObjectScanner::fail() {
+    failed = true;
+    return false;
+}
+
+void JsonObjectScanner::skipWhitespace() {
+    while (position < input.size()) {
+        char c = input[position];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+        position++;
+    }
+}
+
+bool JsonObjectScanner::consume(char c) {
+    skipWhitespace();
+    if (position < input.size() && input[position] == c) {
+        position++;
+        return true;
+    }
+    return false;
+}
+
+bool JsonObjectScanner::next(string_view &key, JsonValue &value) {
+    if (failed || finished) {
+        return false;
+    }
+    if (consume('}')) {
+        // only whitespace may follow the object
+        finished = true;
+        skipWhitespace();
+        return position == input.size() ? false : fail();
+    }
+    if (!first && !consume(',')) {
+        return fail();
+    }
+    first = false;
+    skipWhitespace();
+    if (!scanString(key) || !consume(':') || !scanValue(value, 0)) {
+        return fail();
+    }
+    return true;
+}
+
+bool JsonObjectScanner::scanString(string_view &raw) {
+    if (position >= input.size() || input[position] != '"') {
+        return false;
+    }
+    size_t start = ++position;
+    while (position < input.size()) {
+        char c = input[position];
+        if (c == '"') {
+            raw = input.substr(start, position - start);
+            position++;
+            return true;
+        } else if (c == '\\') {
+            if (++position >= input.size()) {
+                return false;
+            }
+            char escaped = input[position];
+            if (escaped == 'u') {
+                if (!readHex4(input, position + 1).has_value()) {
+                    return false;
+                }
+                position += 4;
+            } else if (!strchr("\"\\/bfnrt", escaped) || escaped == '\0') {
+                return false;
+            }
+        } else if (uint8_t(c) < 0x20) {
+            return false;
+        }
+        position++;
+    }
+    return false;
+}
+
+bool JsonObjectScanner::scanNumber(string_view &raw) {
+    size_t start = position;
+    if (position < input.size() && input[position] == '-') {
+        position++;
+    }
+    if (position >= input.size() || !isDigit(input[position])) {
+        return false;
+    }
+    if (input[position] == '0') {
+        position++;
+    } else {
+        while (position < input.size() && isDigit(input[position])) {
+            position++;
+        }
+    }
+    if (position < input.size() && input[position] == '.') {
+        position++;
+        if (position >= input.size() || !isDigit(input[position])) {
+            return false;
+        }
+        while (position < input.size() && isDigit(input[position])) {
+            position++;
+        }
+    }
+    if (position < input.size() && (input[position] == 'e' || input[position] == 'E')) {
+        position++;
+        if (position < input.size() && (input[position] == '+' || input[position] == '-')) {
+            position++;
+        }
+        if (position >= input.size() || !isDigit(input[position])) {
+            return false;
+        }
+        while (position < input.size() && isDigit(input[position])) {
+            position++;
+        }
+    }
+    raw = input.substr(start, position - start);
+    return true;
+}
+
+bool JsonObjectScanner::scanLiteral(string_view literal) {
+    if (input.substr(position, literal.size()) != literal) {
+        return false;
+    }
+    position += literal.size();
+    return true;
+}
+
+bool JsonObjectScanner::scanValue(JsonValue &value, int depth) {
+    skipWhitespace();
+    if (position >= input.size() || depth > maxDepth) {
+        return false;
+    }
+    size_t start = position;
+    char c = input[position];
+    switch (c) {
+        case '"':
+            value.type = JsonValue::Type::String;
+            return scanString(value.raw);
+        case 't':
+            value.type = JsonValue::Type::True;
+            return scanLiteral("true");
+        case 'f':
+            value.type = JsonValue::Type::False;
+            return scanLiteral("false");
+        case 'n':
+            value.type = JsonValue::Type::Null;
+            return scanLiteral("null");
+        case '{':
+        case '[': {
+            // validate and skip the nested value
+            bool isObject = c == '{';
+            char close = isObject ? '}' : ']';
+            position++;
+            if (!consume(close)) {
+                do {
+                    JsonValue nested;
+                    if (isObject) {
+                        string_view nestedKey;
+                        skipWhitespace();
+                        if (!scanString(nestedKey) || !consume(':')) {
+                            return false;
+                        }
+                    }
+                    if (!scanValue(nested, depth + 1)) {
+                        return false;
+                    }
+                } while (consume(','));
+                if (!consume(close)) {
+                    return false;
+                }
+            }
+            value.type = isObject ? JsonValue::Type::Object : JsonValue::Type::Array;
+            value.raw = input.substr(start, position - start);
+            return true;
+        }
+        default:
+            value.type = JsonValue::Type::Number;
+            return scanNumber(value.raw);
+    }
+}
+
+optional<string> unescapeJsonString(string_view raw) {
+    string out;
+    out.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (++i >= raw.size()) {
+            return nullopt;
+        }
+        switch (raw[i]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                auto codeUnit = readHex4(raw, i + 1);
+                if (!codeUnit.has_value()) {
+                    return nullopt;
+                }
+                i += 4;
+                uint32_t codePoint = codeUnit.value();
+                if (codePoint >= 0xD800 && codePoint < 0xDC00) {
+                    // high surrogate, must be followed by a low one
+                    if (i + 6 >= raw.size() || raw[i + 1] != '\\' || raw[i + 2] != 'u') {
+                        return nullopt;
+                    }
+                    auto low = readHex4(raw, i + 3);
+                    if (!low.has_value() || low.value() < 0xDC00 || low.value() >= 0xE000) {
+                        return nullopt;
+                    }
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low.value() - 0xDC00);
+                    i += 6;
+                } else if (codePoint >= 0xDC00 && codePoint < 0xE000) {
+                    return nullopt;
+                }
+                appendUtf8(out, codePoint);
+                break;
+            }
+            default:
+                return nullopt;
+        }
+    }
+    return out;
+}
+
+bool parseSignalingMessage(string_view text, SignalingMessage &message) {
+    message = SignalingMessage();
+    bool hasId = false;
+    bool hasType = false;
+    JsonObjectScanner scanner(text);
+    string_view key;
+    JsonValue value;
+    while (scanner.next(key, value)) {
+        string_view field;
+        if (key == "id") {
+            hasId = stringValue(value, message.id);
+        } else if (key == "type") {
+            hasType = stringValue(value, message.type);
+        } else if (key == "sdp" && stringValue(value, field)) {
+            message.sdp = field;
+        } else if (key == "candidate" && stringValue(value, field)) {
+            message.candidate = field;
+        } else if (key == "mid" && stringValue(value, field)) {
+            message.mid = field;
+        }
+    }
+    return scanner.ok() && hasId && hasType;
+}
+
+bool parseControlMessage(string_view text, ControlMessage &message) {
+    message = ControlMessage();
+    JsonObjectScanner scanner(text);
+    string_view key;
+    JsonValue value;
+    while (scanner.next(key, value)) {
+        if (key == "x") {
+            message.x = intValue(value);
+        } else if (key == "y") {
+            message.y = intValue(value);
+        } else if (key == "latency") {
+            message.latency = value.asDouble();
+        } else if (key == "lease") {
+            message.lease = value.asPlainString();
+        }
+    }
+    return scanner.ok();
+}
+
+optional<int16_t> ControlFrame::channel(size_t index) const {
+    if (index >= channelCount) {
+        return nullopt;
+    }
+    return channels[index];
+}
+
+bool parseControlFrame(const byte *data, size_t size, ControlFrame &frame) {
+    if (size < ControlFrame::headerSize) {
+        return false;
+    }
+    frame.version = uint8_t(data[0]);
+    if (frame.version != ControlFrame::currentVersion) {
+        return false;
+    }
+    size_t channelCount = size_t(data[1]);
+    if (size < ControlFrame::headerSize + channelCount * 2) {
+        return false;
+    }
+    frame.sequence = readUint32(data + 4);
+    frame.timestamp = readUint32(data + 8);
+    frame.channelCount = std::min(channelCount, ControlFrame::maxChannels);
+    for (size_t i = 0; i < frame.channelCount; i++) {
+        frame.channels[i] = int16_t(readUint16(data + ControlFrame::headerSize + i * 2));
+    }
+    return true;
+}
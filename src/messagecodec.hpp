@@ -0,0 +1,133 @@
+#ifndef messagecodec_hpp
+#define messagecodec_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/// Value of a member of a JSON object, as found in the input
+struct JsonValue {
+    enum class Type {
+        String,
+        Number,
+        True,
+        False,
+        Null,
+        Object,
+        Array
+    };
+    Type type = Type::Null;
+    /// Raw text: string contents without quotes and still escaped, number
+    /// literal, or the whole nested object/array
+    std::string_view raw;
+
+    /// Returns the number as an integer, truncating fractions like nlohmann::json
+    std::optional<int64_t> asInteger() const;
+    std::optional<double> asDouble() const;
+    /// Returns the string if it needs no unescaping, nullopt otherwise
+    std::optional<std::string_view> asPlainString() const;
+};
+
+/// Scans the members of one flat JSON object without allocating
+///
+/// Nested objects and arrays are validated and skipped as a whole. Malformed
+/// input stops the scan and is reported by ok(), nothing throws.
+class JsonObjectScanner {
+public:
+    /// Limit on nesting of skipped values, deeper input is rejected
+    static const int maxDepth = 32;
+
+    JsonObjectScanner(std::string_view input);
+
+    /// Reads the next member
+    /// @param key Raw key, still escaped
+    /// @param value Value of the member
+    /// @returns False at the end of the object or on error
+    bool next(std::string_view &key, JsonValue &value);
+
+    /// True if the input is well formed so far, and entirely after next() returned false
+    bool ok() const;
+
+private:
+    std::string_view input;
+    size_t position = 0;
+    bool failed = false;
+    bool finished = false;
+    bool first = true;
+
+    void skipWhitespace();
+    bool consume(char c);
+    bool scanString(std::string_view &raw);
+    bool scanNumber(std::string_view &raw);
+    bool scanLiteral(std::string_view literal);
+    bool scanValue(JsonValue &value, int depth);
+    bool fail();
+};
+
+/// Unescapes a raw JSON string, only for the cold path
+/// @returns nullopt for invalid escapes
+std::optional<std::string> unescapeJsonString(std::string_view raw);
+
+/// Signaling message received over the WebSocket, fields point into the input
+struct SignalingMessage {
+    std::string_view id;
+    std::string_view type;
+    /// Raw escaped strings, see unescapeJsonString()
+    std::optional<std::string_view> sdp;
+    std::optional<std::string_view> candidate;
+    std::optional<std::string_view> mid;
+};
+
+/// Parses a signaling message
+/// @returns False if the message is malformed or misses the id or type
+bool parseSignalingMessage(std::string_view text, SignalingMessage &message);
+
+/// JSON control message received over the data channel
+struct ControlMessage {
+    std::optional<int> x;
+    std::optional<int> y;
+    std::optional<double> latency;
+    /// Control lease action, "request" or "release"
+    std::optional<std::string_view> lease;
+};
+
+/// Parses a JSON control message
+/// @returns False if the message is malformed
+bool parseControlMessage(std::string_view text, ControlMessage &message);
+
+/// Binary control frame, little endian
+///
+///  0: uint8  version
+///  1: uint8  number of channels
+///  2: uint16 reserved, 0
+///  4: uint32 sequence number, incremented for every frame
+///  8: uint32 sender timestamp in milliseconds
+/// 12: int16  channel values
+struct ControlFrame {
+    static constexpr uint8_t currentVersion = 1;
+    static constexpr size_t headerSize = 12;
+    /// Channels beyond this are ignored
+    static constexpr size_t maxChannels = 16;
+
+    enum Channel {
+        Steering = 0,
+        Throttle = 1
+    };
+
+    uint8_t version = currentVersion;
+    uint32_t sequence = 0;
+    uint32_t timestamp = 0;
+    size_t channelCount = 0;
+    int16_t channels[maxChannels] = {};
+
+    /// Returns the value of a channel, nullopt if the frame does not carry it
+    std::optional<int16_t> channel(size_t index) const;
+};
+
+/// Parses a binary control frame
+/// @returns False if the frame is truncated or of an unknown version
+bool parseControlFrame(const std::byte *data, size_t size, ControlFrame &frame);
+
+#endif /* messagecodec_hpp */
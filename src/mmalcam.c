@@ -24,6 +24,9 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for pthread_setaffinity_np() */
+#endif
 #include <stdlib.h>
 #include <limits.h>
 #include <stdio.h>
@@ -85,6 +88,8 @@ int start_mmalcam(on_buffer_cb cb) {
     vcos_assert(status == VCOS_SUCCESS);
 
     vcos_thread_attr_init(&attrs);
+    vcos_thread_attr_setscheduling(&attrs, camcorder_behaviour.sched_policy, camcorder_behaviour.sched_priority);
+    vcos_thread_attr_setcpus(&attrs, camcorder_behaviour.cpus);
     struct mmalcam_args ma;
     ma.id = &camcorder_behaviour;
     ma.cb = cb;
@@ -145,6 +150,20 @@ static void mmalcam_dump_stats(const char *title, MMAL_PARAMETER_STATISTICS_T *s
     printf("corrupt_macroblocks: %u\n", stats->corrupt_macroblocks);
 }
 
+static void mmalcam_dump_latency(const char *title, const MMAL_CORE_LATENCY_T *latency)
+{
+    unsigned int i;
+
+    if (!latency->count)
+        return;
+    printf("[%s latency]\n", title);
+    printf("count: %u\n", latency->count);
+    printf("max_us: %u\n", latency->max);
+    for (i = 0; i < MMAL_CORE_LATENCY_BUCKETS; i++)
+        if (latency->buckets[i])
+            printf("under_%llu_us: %u\n", 2ULL << i, latency->buckets[i]);
+}
+
 static int show_error(const int *status)
 {
     LOG_TRACE("Waiting for camcorder thread to terminate");
@@ -153,17 +172,52 @@ static int show_error(const int *status)
     mmalcam_dump_stats("Render", &camcorder_behaviour.render_stats);
     if (camcorder_behaviour.uri)
         mmalcam_dump_stats("Encoder", &camcorder_behaviour.encoder_stats);
+    mmalcam_dump_latency("Camera", &camcorder_behaviour.camera_latency);
+    mmalcam_dump_latency("Encoder input", &camcorder_behaviour.encoder_input_latency);
+    mmalcam_dump_latency("Encoder output", &camcorder_behaviour.encoder_output_latency);
 
     vcos_semaphore_delete(&camcorder_behaviour.init_sem);
     return *status;
 }
 
+/*****************************************************************************/
+void mmalcam_set_scheduling(int policy, int priority, uint32_t cpus)
+{
+    camcorder_behaviour.sched_policy = policy;
+    camcorder_behaviour.sched_priority = priority;
+    camcorder_behaviour.cpus = cpus;
+}
+
+/** Applies the scheduling to the calling thread, the system libvcos ignores it in the thread attributes */
+static void mmalcam_apply_scheduling(const MMALCAM_BEHAVIOUR_T *behaviour)
+{
+    struct sched_param param = { .sched_priority = behaviour->sched_policy == SCHED_OTHER ? 0 : behaviour->sched_priority };
+    cpu_set_t cpus;
+    unsigned int cpu;
+    int rc;
+
+    if (behaviour->sched_policy == SCHED_OTHER && !behaviour->cpus)
+        return;
+    if ((rc = pthread_setschedparam(pthread_self(), behaviour->sched_policy, &param)) != 0)
+        LOG_ERROR("couldn't set scheduling policy %d priority %d (%d)", behaviour->sched_policy, behaviour->sched_priority, rc);
+    if (behaviour->cpus)
+    {
+        CPU_ZERO(&cpus);
+        for (cpu = 0; cpu < 32; cpu++)
+            if (behaviour->cpus & (1u << cpu))
+                CPU_SET(cpu, &cpus);
+        if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0)
+            LOG_ERROR("couldn't set CPUs 0x%x (%d)", behaviour->cpus, rc);
+    }
+}
+
 /*****************************************************************************/
 static void *mmal_camcorder(struct mmalcam_args *args)
 {
     MMALCAM_BEHAVIOUR_T *behaviour = args->id;
     int value;
 
+    mmalcam_apply_scheduling(behaviour);
     value = mmal_start_camcorder(&stop, behaviour, args->cb);
 
     LOG_TRACE("Thread terminating, result %d", value);
@@ -82,9 +82,15 @@ typedef struct MMALCAM_BEHAVIOUR_T
    MMALCAM_INIT_STATUS_T init_result;           /**< Result of initialisation */
    MMAL_PARAMETER_STATISTICS_T render_stats;    /**< Video render stats */
    MMAL_PARAMETER_STATISTICS_T encoder_stats;   /**< Video encoder output stats */
+   MMAL_CORE_LATENCY_T camera_latency;          /**< Time buffers spent in the camera video port */
+   MMAL_CORE_LATENCY_T encoder_input_latency;   /**< Time buffers spent in the encoder input port */
+   MMAL_CORE_LATENCY_T encoder_output_latency;  /**< Time buffers spent in the encoder output port */
    uint32_t bit_rate;                           /**< Video encoder bit rate */
    MMAL_PARAM_FOCUS_T focus_test;               /**< Set to given focus, MMAL_PARAM_FOCUS_MAX to disable */
    uint32_t camera_num;                         /**< camera number */
+   int sched_policy;                            /**< Scheduling policy of the camcorder and component threads */
+   int sched_priority;                          /**< Priority for SCHED_FIFO and SCHED_RR */
+   uint32_t cpus;                               /**< Mask of the CPUs these threads run on, 0 for all */
 } MMALCAM_BEHAVIOUR_T;
 
 /** Start the camcorder.
@@ -115,6 +121,15 @@ static void *mmal_camcorder(struct mmalcam_args *args);
 
 
 int start_mmalcam(on_buffer_cb cb);
+
+/** Set the scheduling of the camcorder thread and of the camera and encoder
+ * action threads, before start_mmalcam().
+ *
+ * @param policy SCHED_OTHER, SCHED_FIFO or SCHED_RR
+ * @param priority Priority for SCHED_FIFO and SCHED_RR
+ * @param cpus Mask of the CPUs the threads may run on, 0 for all
+ */
+void mmalcam_set_scheduling(int policy, int priority, uint32_t cpus);
 #ifdef __cplusplus
 }
 #endif
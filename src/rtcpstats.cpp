@@ -0,0 +1,139 @@
+#include "rtcpstats.hpp"
+#include "helpers.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+using namespace std;
+using namespace rtc;
+
+/// Middle 32 bits of the NTP timestamp, as used by LSR/DLSR
+static uint32_t compactNtp(uint64_t timeInMicroSeconds) {
+    return uint32_t(toNtpTimestamp(timeInMicroSeconds) >> 16);
+}
+
+void to_json(nlohmann::json &j, const RtcpStats &stats) {
+    j = nlohmann::json{
+        {"ssrc", stats.ssrc},
+        {"fractionLost", stats.fractionLost},
+        {"cumulativeLost", stats.cumulativeLost},
+        {"highestSeqNo", stats.highestSeqNo},
+        {"jitterMs", stats.jitterMs},
+        {"bitrate", stats.bitrate},
+        {"packetsSent", stats.packetsSent},
+        {"bytesSent", stats.bytesSent},
+        {"reportCount", stats.reportCount},
+        {"lastReportTime", stats.lastReportTime}
+    };
+    if (stats.rttMs.has_value()) {
+        j["rttMs"] = stats.rttMs.value();
+    } else {
+        j["rttMs"] = nullptr;
+    }
+    if (stats.latencyMs.has_value()) {
+        j["latencyMs"] = stats.latencyMs.value();
+    } else {
+        j["latencyMs"] = nullptr;
+    }
+}
+
+RtcpStatsReporter::RtcpStatsReporter(shared_ptr<RtpPacketizationConfig> rtpConfig)
+    : MediaHandlerElement(), rtpConfig(rtpConfig) {
+    current.ssrc = rtpConfig->ssrc;
+}
+
+ChainedIncomingControlProduct RtcpStatsReporter::processIncomingControlMessage(message_ptr message) {
+    auto arrivalNtp = compactNtp(currentTimeInMicroSeconds());
+    size_t offset = 0;
+    while (offset + sizeof(RtcpHeader) <= message->size()) {
+        auto header = reinterpret_cast<const RtcpHeader *>(message->data() + offset);
+        size_t length = header->lengthInBytes();
+        if (header->version() != 2 || offset + length > message->size()) {
+            break;
+        }
+        uint8_t reportCount = header->reportCount();
+        if (header->payloadType() == 200 && RtcpSr::Size(reportCount) <= length) {
+            auto sr = reinterpret_cast<const RtcpSr *>(header);
+            for (int i = 0; i < reportCount; i++) {
+                processReportBlock(sr->getReportBlock(i), arrivalNtp);
+            }
+        } else if (header->payloadType() == 201 && RtcpRr::SizeWithReportBlocks(reportCount) <= length) {
+            auto rr = reinterpret_cast<const RtcpRr *>(header);
+            for (int i = 0; i < reportCount; i++) {
+                processReportBlock(rr->getReportBlock(i), arrivalNtp);
+            }
+        }
+        offset += length;
+    }
+    return {message, nullopt};
+}
+
+void RtcpStatsReporter::processReportBlock(const RtcpReportBlock *block, uint32_t arrivalNtp) {
+    if (block->getSSRC() != rtpConfig->ssrc) {
+        return;
+    }
+    uint32_t lost = ntohl(block->_fractionLostAndPacketsLost);
+    // packets lost is a signed 24-bit value
+    int32_t cumulativeLost = int32_t(lost & 0x00FFFFFF);
+    if (cumulativeLost & 0x00800000) {
+        cumulativeLost -= 0x01000000;
+    }
+    uint32_t lastReport = ntohl(block->_lastReport);
+    uint32_t delaySinceLastReport = block->delaySinceSR();
+
+    std::unique_lock lock(mutex);
+    current.fractionLost = double(lost >> 24) / 256;
+    current.cumulativeLost = cumulativeLost;
+    current.highestSeqNo = (uint32_t(block->seqNoCycles()) << 16) | block->highestSeqNo();
+    current.jitterMs = double(block->jitter()) * 1000 / rtpConfig->clockRate;
+    // LSR is zero until the peer received one of our sender reports
+    if (lastReport != 0) {
+        uint32_t rtt = arrivalNtp - lastReport - delaySinceLastReport;
+        // rtt is in 1/65536 seconds, ignore values wrapped by clock skew
+        if (rtt < 0x80000000) {
+            current.rttMs = double(rtt) * 1000 / 65536;
+        }
+    }
+    current.reportCount++;
+    current.lastReportTime = currentTimeInMicroSeconds();
+}
+
+ChainedOutgoingProduct RtcpStatsReporter::processOutgoingBinaryMessage(ChainedMessagesProduct messages,
+                                                                       message_ptr control) {
+    uint64_t bytes = 0;
+    for (const auto &message : *messages) {
+        bytes += message->size();
+    }
+    auto now = currentTimeInMicroSeconds();
+
+    std::unique_lock lock(mutex);
+    current.packetsSent += messages->size();
+    current.bytesSent += bytes;
+    if (windowStart == 0) {
+        windowStart = now;
+    }
+    windowBytes += bytes;
+    if (now - windowStart >= bitrateWindow) {
+        current.bitrate = double(windowBytes) * 8 * 1000 * 1000 / (now - windowStart);
+        windowStart = now;
+        windowBytes = 0;
+    }
+    return {messages, control};
+}
+
+RtcpStats RtcpStatsReporter::stats() {
+    std::unique_lock lock(mutex);
+    // nothing was sent during the last window
+    if (windowStart != 0 && currentTimeInMicroSeconds() - windowStart >= 2 * bitrateWindow) {
+        current.bitrate = 0;
+    }
+    return current;
+}
+
+void RtcpStatsReporter::reportLatency(double latencyMs) {
+    std::unique_lock lock(mutex);
+    current.latencyMs = latencyMs;
+}
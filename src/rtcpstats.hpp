@@ -0,0 +1,74 @@
+#ifndef rtcpstats_hpp
+#define rtcpstats_hpp
+
+#include "rtc/rtc.hpp"
+#include "nlohmann/json.hpp"
+
+#include <mutex>
+#include <optional>
+
+/// Snapshot of the sending statistics of one track towards one peer
+struct RtcpStats {
+    uint32_t ssrc = 0;
+    /// Fraction of packets lost since the previous receiver report (0..1)
+    double fractionLost = 0;
+    /// Cumulative number of packets lost reported by the receiver
+    int32_t cumulativeLost = 0;
+    /// Extended highest sequence number received by the peer
+    uint32_t highestSeqNo = 0;
+    /// Interarrival jitter in milliseconds
+    double jitterMs = 0;
+    /// Round trip time computed from LSR/DLSR, if the peer echoed one of our SRs
+    std::optional<double> rttMs = std::nullopt;
+    /// Sent bitrate over the last measurement window in bits per second
+    double bitrate = 0;
+    uint64_t packetsSent = 0;
+    uint64_t bytesSent = 0;
+    /// Number of report blocks received for this SSRC
+    uint32_t reportCount = 0;
+    /// Wall clock time of the last report block in microseconds
+    uint64_t lastReportTime = 0;
+    /// Capture to playout latency reported by the peer from abs-capture-time
+    std::optional<double> latencyMs = std::nullopt;
+};
+
+void to_json(nlohmann::json &j, const RtcpStats &stats);
+
+/// Media handler element keeping rolling stats from the receiver reports of a peer
+class RtcpStatsReporter final : public rtc::MediaHandlerElement {
+public:
+    /// Length of the bitrate measurement window
+    static constexpr uint64_t bitrateWindow = 1000 * 1000;
+
+    RtcpStatsReporter(std::shared_ptr<rtc::RtpPacketizationConfig> rtpConfig);
+
+    /// Parses report blocks of incoming SR/RR packets about our SSRC
+    /// @param message RTCP message
+    /// @returns Unchanged RTCP message
+    rtc::ChainedIncomingControlProduct processIncomingControlMessage(rtc::message_ptr message) override;
+
+    /// Accounts sent RTP packets for bitrate
+    /// @param messages RTP packets
+    /// @param control RTCP
+    /// @returns Unchanged RTP and RTCP
+    rtc::ChainedOutgoingProduct processOutgoingBinaryMessage(rtc::ChainedMessagesProduct messages,
+                                                             rtc::message_ptr control) override;
+
+    /// Returns a copy of the current stats
+    RtcpStats stats();
+
+    /// Records the capture to playout latency measured by the peer
+    /// @param latencyMs Latency in milliseconds
+    void reportLatency(double latencyMs);
+
+private:
+    const std::shared_ptr<rtc::RtpPacketizationConfig> rtpConfig;
+    std::mutex mutex;
+    RtcpStats current;
+    uint64_t windowStart = 0;
+    uint64_t windowBytes = 0;
+
+    void processReportBlock(const rtc::RtcpReportBlock *block, uint32_t arrivalNtp);
+};
+
+#endif /* rtcpstats_hpp */
@@ -0,0 +1,158 @@
+#include "servo.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if HAVE_PIGPIO
+#include <pigpio.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+/// Pins of the RC car, BCM numbering
+const unsigned steeringPin = 13;
+const unsigned throttlePin = 12;
+const int neutralPulseWidth = 1500;
+
+#if HAVE_PIGPIO
+bool pigpioInitialised = false;
+#endif
+
+bool writeFile(const string &path, const string &value) {
+    ofstream file(path);
+    file << value;
+    file.flush();
+    return bool(file);
+}
+
+} // namespace
+
+#if HAVE_PIGPIO
+PigpioServo::PigpioServo(unsigned pin) : pin(pin) {
+    gpioSetMode(pin, PI_OUTPUT);
+}
+
+void PigpioServo::setPulseWidth(int pulseWidth) {
+    gpioServo(pin, unsigned(pulseWidth));
+}
+#endif
+
+SysfsPwmServo::SysfsPwmServo(unsigned chip, unsigned channel, int neutral)
+    : path("/sys/class/pwm/pwmchip" + to_string(chip) + "/pwm" + to_string(channel)) {
+    string chipPath = "/sys/class/pwm/pwmchip" + to_string(chip);
+    if (access(path.c_str(), F_OK) != 0) {
+        if (!writeFile(chipPath + "/export", to_string(channel))) {
+            throw runtime_error("Unable to export PWM channel " + path +
+                                ", is dtoverlay=pwm-2chan,pin=12,func=4,pin2=13,func2=4 set?");
+        }
+        // udev fixes the permissions of the new attributes asynchronously
+        for (int i = 0; i < 50 && access((path + "/period").c_str(), W_OK) != 0; i++) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    // the duty cycle may not exceed the period, set it first
+    writeFile(path + "/duty_cycle", "0");
+    if (!writeFile(path + "/period", to_string(periodNs)) ||
+        !writeFile(path + "/duty_cycle", to_string(neutral * 1000)) ||
+        !writeFile(path + "/enable", "1")) {
+        throw runtime_error("Unable to configure PWM channel " + path);
+    }
+    dutyCycleFd = open((path + "/duty_cycle").c_str(), O_WRONLY);
+    if (dutyCycleFd < 0) {
+        throw runtime_error("Unable to open " + path + "/duty_cycle: " + strerror(errno));
+    }
+}
+
+SysfsPwmServo::~SysfsPwmServo() {
+    if (dutyCycleFd >= 0) {
+        close(dutyCycleFd);
+    }
+    writeFile(path + "/enable", "0");
+}
+
+void SysfsPwmServo::setPulseWidth(int pulseWidth) {
+    char value[16];
+    int length = snprintf(value, sizeof(value), "%d", pulseWidth * 1000);
+    // sysfs attributes are rewritten from offset 0
+    if (pwrite(dutyCycleFd, value, size_t(length), 0) < 0) {
+        // keep the last pulse width, the ESC holds it too
+        return;
+    }
+}
+
+SimulatedServo::SimulatedServo(int neutral, size_t capacity) : current(neutral) {
+    recorded.reserve(capacity);
+}
+
+void SimulatedServo::setPulseWidth(int pulseWidth) {
+    if (recorded.size() < recorded.capacity()) {
+        auto now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch());
+        recorded.push_back({uint64_t(now.count()), pulseWidth});
+    }
+    current.store(pulseWidth, memory_order_relaxed);
+    updates.fetch_add(1, memory_order_relaxed);
+}
+
+int SimulatedServo::pulseWidth() const {
+    return current.load(memory_order_relaxed);
+}
+
+uint64_t SimulatedServo::updateCount() const {
+    return updates.load(memory_order_relaxed);
+}
+
+vector<SimulatedServo::Sample> SimulatedServo::samples() const {
+    return recorded;
+}
+
+#if HAVE_PIGPIO
+const char *const defaultServoBackend = "pigpio";
+#else
+const char *const defaultServoBackend = "sim";
+#endif
+
+ServoOutputs makeServoOutputs(const string &backend) {
+    ServoOutputs outputs;
+    if (backend == "pigpio") {
+#if HAVE_PIGPIO
+        if (!pigpioInitialised && gpioInitialise() < 0) {
+            throw runtime_error("Unable to initialise pigpio");
+        }
+        pigpioInitialised = true;
+        outputs.steering = make_unique<PigpioServo>(steeringPin);
+        outputs.throttle = make_unique<PigpioServo>(throttlePin);
+#else
+        throw runtime_error("Built without pigpio");
+#endif
+    } else if (backend == "sysfs") {
+        // dtoverlay=pwm-2chan,pin=12,func=4,pin2=13,func2=4: channel 0 on GPIO 12, channel 1 on GPIO 13
+        outputs.steering = make_unique<SysfsPwmServo>(0, 1, neutralPulseWidth);
+        outputs.throttle = make_unique<SysfsPwmServo>(0, 0, neutralPulseWidth);
+    } else if (backend == "sim") {
+        outputs.steering = make_unique<SimulatedServo>(neutralPulseWidth);
+        outputs.throttle = make_unique<SimulatedServo>(neutralPulseWidth);
+    } else {
+        throw runtime_error("Unknown servo backend " + backend);
+    }
+    outputs.steering->setPulseWidth(neutralPulseWidth);
+    outputs.throttle->setPulseWidth(neutralPulseWidth);
+    return outputs;
+}
+
+void terminateServoBackends() {
+#if HAVE_PIGPIO
+    if (pigpioInitialised) {
+        gpioTerminate();
+        pigpioInitialised = false;
+    }
+#endif
+}
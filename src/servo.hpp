@@ -0,0 +1,109 @@
+#ifndef servo_hpp
+#define servo_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Output driving one servo or ESC with a pulse width
+class ServoOutput {
+public:
+    virtual ~ServoOutput() = default;
+
+    /// @param pulseWidth Pulse width in microseconds
+    virtual void setPulseWidth(int pulseWidth) = 0;
+};
+
+#if HAVE_PIGPIO
+/// Servo pulses generated by pigpio on any GPIO
+class PigpioServo final : public ServoOutput {
+public:
+    /// @param pin BCM GPIO number, gpioInitialise() must have succeeded
+    PigpioServo(unsigned pin);
+
+    void setPulseWidth(int pulseWidth) override;
+
+private:
+    const unsigned pin;
+};
+#endif
+
+/// Servo pulses generated by the PWM hardware, through /sys/class/pwm
+///
+/// Unlike pigpio, this needs no daemon sampling the GPIOs. On a Raspberry Pi,
+/// dtoverlay=pwm-2chan,pin=12,func=4,pin2=13,func2=4 routes PWM channels 0
+/// and 1 to GPIO 12 and 13. Without the pin arguments the overlay uses GPIO 18
+/// and 19.
+class SysfsPwmServo final : public ServoOutput {
+public:
+    /// Servo frame period
+    static const unsigned periodNs = 20 * 1000 * 1000;
+
+    /// Exports and enables the channel
+    /// @param chip PWM chip number
+    /// @param channel Channel of the chip
+    /// @param neutral Initial pulse width in microseconds
+    /// @throws std::runtime_error if the channel can not be set up
+    SysfsPwmServo(unsigned chip, unsigned channel, int neutral = 1500);
+    /// Disables the channel
+    ~SysfsPwmServo();
+
+    void setPulseWidth(int pulseWidth) override;
+
+    SysfsPwmServo(const SysfsPwmServo &) = delete;
+    SysfsPwmServo &operator=(const SysfsPwmServo &) = delete;
+
+private:
+    const std::string path;
+    /// duty_cycle, kept open so an update is a single write
+    int dutyCycleFd = -1;
+};
+
+/// Stand-in for a servo off-device, recording when each command was applied
+class SimulatedServo final : public ServoOutput {
+public:
+    struct Sample {
+        /// Steady clock time in nanoseconds
+        uint64_t time;
+        int pulseWidth;
+    };
+
+    /// @param neutral Initial pulse width
+    /// @param capacity Number of samples kept, later ones are only counted
+    SimulatedServo(int neutral = 1500, size_t capacity = 0);
+
+    /// Called from a single thread
+    void setPulseWidth(int pulseWidth) override;
+
+    int pulseWidth() const;
+    /// Number of setPulseWidth() calls
+    uint64_t updateCount() const;
+    /// Recorded samples, once the writing thread stopped
+    std::vector<Sample> samples() const;
+
+private:
+    std::atomic<int> current;
+    std::atomic<uint64_t> updates = 0;
+    std::vector<Sample> recorded;
+};
+
+/// Steering and throttle outputs of one backend
+struct ServoOutputs {
+    std::unique_ptr<ServoOutput> steering;
+    std::unique_ptr<ServoOutput> throttle;
+};
+
+/// Name of the backend used when none is given, pigpio if built with it
+extern const char *const defaultServoBackend;
+
+/// Creates the steering (GPIO 13) and throttle (GPIO 12) outputs, set to neutral
+/// @param backend "pigpio", "sysfs" or "sim"
+/// @throws std::runtime_error if the backend is unknown or unavailable
+ServoOutputs makeServoOutputs(const std::string &backend);
+
+/// Releases the libraries initialised by makeServoOutputs(), after the outputs are destroyed
+void terminateServoBackends();
+
+#endif /* servo_hpp */
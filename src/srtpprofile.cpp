@@ -0,0 +1,112 @@
+#include "srtpprofile.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#if defined(__linux__) && (defined(__arm__) || defined(__aarch64__))
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+mutex profilesMutex;
+string profilesList;
+
+typedef int (*use_srtp_t)(struct ssl_st *, const char *);
+
+use_srtp_t realUseSrtp() {
+    static use_srtp_t function = reinterpret_cast<use_srtp_t>(dlsym(RTLD_NEXT, "SSL_set_tlsext_use_srtp"));
+    return function;
+}
+
+bool hasAesInstructions() {
+#if defined(__aarch64__) && defined(HWCAP_AES) && defined(HWCAP_PMULL)
+    auto hwcap = getauxval(AT_HWCAP);
+    return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#elif defined(__arm__) && defined(HWCAP2_AES) && defined(HWCAP2_PMULL)
+    auto hwcap2 = getauxval(AT_HWCAP2);
+    return (hwcap2 & HWCAP2_AES) && (hwcap2 & HWCAP2_PMULL);
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#else
+    return false;
+#endif
+}
+
+string join(const vector<string> &profiles) {
+    string list;
+    for (auto &profile: profiles) {
+        if (!list.empty()) {
+            list += ":";
+        }
+        list += profile;
+    }
+    return list;
+}
+
+} // namespace
+
+const vector<string> SrtpProfiles::supported = {
+    "SRTP_AES128_CM_SHA1_80",
+    "SRTP_AEAD_AES_128_GCM",
+    "SRTP_AEAD_AES_256_GCM"
+};
+
+vector<string> SrtpProfiles::deviceDefault() {
+    if (hasAesInstructions()) {
+        return {"SRTP_AEAD_AES_128_GCM", "SRTP_AES128_CM_SHA1_80", "SRTP_AEAD_AES_256_GCM"};
+    }
+    // software GHASH costs more than HMAC-SHA1, and AES-256 has 40% more rounds
+    return {"SRTP_AES128_CM_SHA1_80", "SRTP_AEAD_AES_128_GCM", "SRTP_AEAD_AES_256_GCM"};
+}
+
+void SrtpProfiles::setPreferred(const vector<string> &profiles) {
+    if (profiles.empty()) {
+        throw invalid_argument("No SRTP profile given");
+    }
+    for (auto &profile: profiles) {
+        if (find(supported.begin(), supported.end(), profile) == supported.end()) {
+            throw invalid_argument("Unsupported SRTP profile " + profile);
+        }
+    }
+    lock_guard<mutex> lock(profilesMutex);
+    profilesList = join(profiles);
+}
+
+vector<string> SrtpProfiles::parse(const string &list) {
+    vector<string> profiles;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(':', start);
+        if (end == string::npos) {
+            end = list.size();
+        }
+        if (end > start) {
+            profiles.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return profiles;
+}
+
+string SrtpProfiles::preferred() {
+    lock_guard<mutex> lock(profilesMutex);
+    return profilesList;
+}
+
+/// Replaces the OpenSSL function libdatachannel uses to set its SRTP profiles
+/// @returns 0 on success, like OpenSSL
+extern "C" __attribute__((visibility("default")))
+int SSL_set_tlsext_use_srtp(struct ssl_st *ssl, const char *profiles) {
+    string preferred = SrtpProfiles::preferred();
+    if (!preferred.empty() && realUseSrtp()(ssl, preferred.c_str()) == 0) {
+        return 0;
+    }
+    return realUseSrtp()(ssl, profiles);
+}
@@ -0,0 +1,35 @@
+#ifndef srtpprofile_hpp
+#define srtpprofile_hpp
+
+#include <string>
+#include <vector>
+
+/// Preferred order of the DTLS-SRTP protection profiles
+///
+/// libdatachannel hardcodes the profiles it offers in the DTLS handshake, and
+/// rtc::Configuration has no setting for them. The list is passed to OpenSSL
+/// with SSL_set_tlsext_use_srtp(), which is replaced here to substitute our own
+/// order. As DTLS server, OpenSSL selects the first profile of this list that
+/// the peer supports, so the order decides how much CPU each packet costs.
+class SrtpProfiles {
+public:
+    /// Profiles libdatachannel can key, in OpenSSL naming
+    static const std::vector<std::string> supported;
+
+    /// Cheapest first for this CPU: AES-GCM with AES and carry-less multiply
+    /// instructions, AES-CM with HMAC-SHA1 in software otherwise
+    static std::vector<std::string> deviceDefault();
+
+    /// Sets the profiles to negotiate, most preferred first
+    /// @param profiles Non empty subset of supported
+    /// @throws std::invalid_argument for unknown profiles
+    static void setPreferred(const std::vector<std::string> &profiles);
+
+    /// Parses a colon separated list of profiles, as OpenSSL does
+    static std::vector<std::string> parse(const std::string &list);
+
+    /// Returns the colon separated profiles in use, empty to keep libdatachannel's
+    static std::string preferred();
+};
+
+#endif /* srtpprofile_hpp */
@@ -0,0 +1,210 @@
+#include "threadpool.hpp"
+
+#include <climits>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+/// Pool whose worker is the calling thread, nullptr outside of pool threads
+static thread_local const WorkStealingPool *currentPool = nullptr;
+
+bool pinCurrentThread(int core) {
+    if (core < 0 || core >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+ThreadScheduling ThreadScheduling::parse(const string &value) {
+    if (value == "none") {
+        return {SCHED_OTHER, 0};
+    }
+    auto separator = value.find(':');
+    string name = value.substr(0, separator);
+    int policy;
+    if (name == "fifo") {
+        policy = SCHED_FIFO;
+    } else if (name == "rr") {
+        policy = SCHED_RR;
+    } else {
+        throw runtime_error("Invalid scheduling policy " + name);
+    }
+    size_t end = 0;
+    int priority = -1;
+    try {
+        priority = stoi(value.substr(separator == string::npos ? value.size() : separator + 1), &end);
+    } catch (const exception &) {
+    }
+    if (separator == string::npos || end != value.size() - separator - 1 ||
+        priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) {
+        throw runtime_error("Invalid " + name + " priority in " + value);
+    }
+    return {policy, priority};
+}
+
+void WorkStealingPool::Group::wait() {
+    uint32_t value;
+    while ((value = pending.load()) != 0) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&pending), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+    }
+}
+
+void WorkStealingPool::Group::done() {
+    // the waiter may return and destroy the group as soon as pending is zero,
+    // waking up an address that is gone is harmless
+    if (pending.fetch_sub(1) == 1) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&pending), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+vector<int> WorkStealingPool::defaultCores() {
+    vector<int> cores;
+    int count = int(thread::hardware_concurrency());
+    if (count >= 3) {
+        for (int core = 1; core < count; core++) {
+            cores.push_back(core);
+        }
+    }
+    return cores;
+}
+
+vector<int> WorkStealingPool::parseCores(const string &list) {
+    vector<int> cores;
+    if (list == "none") {
+        return cores;
+    }
+    stringstream stream(list);
+    string core;
+    while (getline(stream, core, ',')) {
+        size_t end = 0;
+        int value = -1;
+        try {
+            value = stoi(core, &end);
+        } catch (const exception &) {
+        }
+        if (value < 0 || end != core.size()) {
+            throw runtime_error("Invalid core " + core);
+        }
+        cores.push_back(value);
+    }
+    if (cores.empty()) {
+        throw runtime_error("No core given");
+    }
+    return cores;
+}
+
+WorkStealingPool::WorkStealingPool(string name, const vector<int> &cores, size_t capacity) : name(std::move(name)) {
+    if (cores.empty()) {
+        throw runtime_error("Pool " + this->name + " needs at least one core");
+    }
+    for (size_t i = 0; i < cores.size(); i++) {
+        rings.push_back(make_unique<TaskRing>(capacity));
+    }
+    for (size_t i = 0; i < cores.size(); i++) {
+        int core = cores[i];
+        threads.emplace_back([this, i, core]() {
+            if (!pinCurrentThread(core)) {
+                std::cout << "Unable to pin " << this->name << " thread to core " << core << std::endl;
+            }
+            workerThreadHandler(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    quit.store(true);
+    parking.notifyAll();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+size_t WorkStealingPool::size() const {
+    return threads.size();
+}
+
+void WorkStealingPool::submit(size_t key, Task &&task) {
+    size_t first = key % rings.size();
+    for (size_t i = first;; i = (i + 1) % rings.size()) {
+        if (rings[i]->tryPush(task)) {
+            break;
+        }
+        if ((i + 1) % rings.size() == first) {
+            if (currentPool == this) {
+                // every worker may be here waiting for room, run it on this one
+                task();
+                return;
+            }
+            // every ring is full, let the threads catch up
+            std::this_thread::yield();
+        }
+    }
+    // any thread will do, the one that wakes up steals the task if it is not its own
+    parking.notify();
+}
+
+bool WorkStealingPool::steal(size_t index, Task &task) {
+    for (size_t i = 1; i < rings.size(); i++) {
+        if (rings[(index + i) % rings.size()]->tryPop(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::workerThreadHandler(size_t index) {
+    currentPool = this;
+    TaskRing &ring = *rings[index];
+    Task batch[batchSize];
+    int idle = 0;
+    while (!quit.load(std::memory_order_relaxed)) {
+        size_t count = 0;
+        while (count < batchSize && ring.tryPop(batch[count])) {
+            count++;
+        }
+        // steal one task at a time, the owner may be about to get to the rest
+        if (count == 0 && steal(index, batch[0])) {
+            count = 1;
+        }
+        if (count > 0) {
+            idle = 0;
+            if (count == batchSize && parking.hasSleepers()) {
+                parking.notify();
+            }
+            for (size_t i = 0; i < count; i++) {
+                batch[i]();
+                batch[i].reset();
+            }
+            continue;
+        }
+        if (++idle < DispatchQueue::spinCount) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        uint32_t ticket = parking.prepare();
+        Task task;
+        if (ring.tryPop(task) || steal(index, task)) {
+            parking.cancel();
+            task();
+            continue;
+        }
+        if (!quit.load()) {
+            parking.wait(ticket);
+        } else {
+            parking.cancel();
+        }
+        idle = 0;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef threadpool_hpp
+#define threadpool_hpp
+
+#include "dispatchqueue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Pins the calling thread to a core
+/// @returns False if the core does not exist or is not allowed
+bool pinCurrentThread(int core);
+
+/// Scheduling policy and priority of a thread
+struct ThreadScheduling {
+    int policy;
+    int priority = 0;
+
+    /// Parses "fifo:<priority>", "rr:<priority>" or "none" for SCHED_OTHER
+    static ThreadScheduling parse(const std::string &value);
+};
+
+/// Runs CPU-bound tasks on threads pinned to given cores
+///
+/// Every thread has its own TaskRing. A task is queued on the ring of the thread
+/// picked by its key, so the jobs of one peer keep to one core while the load is
+/// even, and threads that run out of work steal from the rings of the others.
+/// Nothing is shared between threads but the rings and the futex they sleep on.
+class WorkStealingPool {
+public:
+    /// Default number of tasks each ring can hold
+    static const size_t defaultCapacity = 256;
+    /// Tasks a thread takes from its own ring at once
+    static const size_t batchSize = 8;
+
+    /// Counts the tasks of a fork-join, e.g. the fan-out of one frame
+    class Group {
+    public:
+        /// Blocks until all tasks submitted with this group have run
+        void wait();
+
+    private:
+        friend class WorkStealingPool;
+        std::atomic<uint32_t> pending = 0;
+
+        void done();
+    };
+
+    /// All cores but the first one, which is left to the camera, or none on
+    /// boards with less than three cores where the pool would not pay off
+    static std::vector<int> defaultCores();
+
+    /// Parses a comma separated list of cores, "none" for an empty one
+    static std::vector<int> parseCores(const std::string &list);
+
+    /// @param name Pool name, for debugging
+    /// @param cores One thread is pinned to every core of the list
+    /// @param capacity Capacity of each ring, rounded up to a power of two
+    WorkStealingPool(std::string name, const std::vector<int> &cores, size_t capacity = defaultCapacity);
+    ~WorkStealingPool();
+
+    /// Number of threads
+    size_t size() const;
+
+    /// Queues a task on the thread for key, waiting for room while all rings are full
+    ///
+    /// A worker of the pool runs the task itself instead, as all workers may be waiting.
+    /// @param key Tasks with the same key start on the same thread, e.g. a peer index
+    /// @param task Task
+    void submit(size_t key, Task &&task);
+
+    template <typename F> void submit(size_t key, F &&function) {
+        submit(key, Task(std::forward<F>(function)));
+    }
+
+    /// Queues a task counted by group, see Group::wait()
+    template <typename F> void submit(Group &group, size_t key, F &&function) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        submit(key, Task([&group, function = std::forward<F>(function)]() mutable {
+            function();
+            group.done();
+        }));
+    }
+
+    // Deleted operations
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+private:
+    std::string name;
+    std::vector<std::unique_ptr<TaskRing>> rings;
+    ThreadParking parking;
+    std::atomic<bool> quit = false;
+    std::vector<std::thread> threads;
+
+    /// Takes a task from the ring of another thread
+    bool steal(size_t index, Task &task);
+
+    void workerThreadHandler(size_t index);
+};
+
+#endif /* threadpool_hpp */
@@ -0,0 +1,220 @@
+#include "udpbatch.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+namespace {
+
+/// Kernels before 5.x limit GSO to 64 segments
+const size_t maxGsoSegments = 64;
+/// Largest UDP payload over IPv4
+const size_t maxGsoSize = 65507;
+
+struct Datagram {
+    int fd;
+    int flags;
+    size_t length;
+    sockaddr_storage address;
+    socklen_t addressLength;
+};
+
+struct ThreadBatch {
+    bool active = false;
+    size_t count = 0;
+    Datagram datagrams[UdpSendBatch::maxDatagrams];
+    std::byte data[UdpSendBatch::maxDatagrams][UdpSendBatch::maxDatagramSize];
+
+    // scratch space for flush
+    mmsghdr messages[UdpSendBatch::maxDatagrams];
+    iovec iovecs[UdpSendBatch::maxDatagrams];
+    char control[UdpSendBatch::maxDatagrams][CMSG_SPACE(sizeof(uint16_t))];
+    size_t firstDatagram[UdpSendBatch::maxDatagrams];
+    size_t segmentCount[UdpSendBatch::maxDatagrams];
+};
+
+std::atomic<bool> enabled = false;
+#ifdef UDP_SEGMENT
+std::atomic<bool> gsoSupported = true;
+#else
+std::atomic<bool> gsoSupported = false;
+#endif
+
+// allocated on first use, most threads never batch
+thread_local std::unique_ptr<ThreadBatch> threadBatch = nullptr;
+
+typedef ssize_t (*sendto_t)(int, const void *, size_t, int, const struct sockaddr *, socklen_t);
+
+sendto_t realSendto() {
+    static sendto_t function = reinterpret_cast<sendto_t>(dlsym(RTLD_NEXT, "sendto"));
+    return function;
+}
+
+bool sameDestination(const Datagram &a, const Datagram &b) {
+    return a.addressLength == b.addressLength && memcmp(&a.address, &b.address, a.addressLength) == 0;
+}
+
+void sendDirectly(ThreadBatch &batch, size_t index) {
+    const Datagram &datagram = batch.datagrams[index];
+    realSendto()(datagram.fd, batch.data[index], datagram.length, datagram.flags,
+                 reinterpret_cast<const sockaddr *>(&datagram.address), datagram.addressLength);
+}
+
+/// Tells whether sendmmsg() failed because the kernel or the device cannot segment
+bool isGsoUnsupported(int error) {
+    return error == EIO || error == EINVAL || error == ENOPROTOOPT || error == EOPNOTSUPP;
+}
+
+/// Sends datagrams [begin, end) which share the same socket and flags
+void sendRun(ThreadBatch &batch, size_t begin, size_t end) {
+    bool gso = gsoSupported.load(std::memory_order_relaxed);
+    size_t count = 0;
+    for (size_t i = begin; i < end;) {
+        const Datagram &first = batch.datagrams[i];
+        size_t j = i + 1;
+        // a GSO message is a run of equally sized datagrams to the same address,
+        // only the last one may be shorter
+        if (gso) {
+            size_t total = first.length;
+            while (j < end && j - i < maxGsoSegments && sameDestination(first, batch.datagrams[j]) &&
+                   batch.datagrams[j].length <= first.length && total + batch.datagrams[j].length <= maxGsoSize) {
+                total += batch.datagrams[j].length;
+                j++;
+                if (batch.datagrams[j - 1].length < first.length) {
+                    break;
+                }
+            }
+        }
+
+        for (size_t k = i; k < j; k++) {
+            batch.iovecs[k].iov_base = batch.data[k];
+            batch.iovecs[k].iov_len = batch.datagrams[k].length;
+        }
+        mmsghdr &message = batch.messages[count];
+        memset(&message, 0, sizeof(message));
+        message.msg_hdr.msg_name = const_cast<sockaddr_storage *>(&first.address);
+        message.msg_hdr.msg_namelen = first.addressLength;
+        message.msg_hdr.msg_iov = &batch.iovecs[i];
+        message.msg_hdr.msg_iovlen = j - i;
+#ifdef UDP_SEGMENT
+        if (j - i > 1) {
+            message.msg_hdr.msg_control = batch.control[count];
+            message.msg_hdr.msg_controllen = sizeof(batch.control[count]);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segmentSize = uint16_t(first.length);
+            memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+        }
+#endif
+        batch.firstDatagram[count] = i;
+        batch.segmentCount[count] = j - i;
+        count++;
+        i = j;
+    }
+
+    int fd = batch.datagrams[begin].fd;
+    int flags = batch.datagrams[begin].flags;
+    size_t sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(fd, batch.messages + sent, unsigned(count - sent), flags);
+        if (result > 0) {
+            sent += result;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (batch.segmentCount[sent] > 1 && isGsoUnsupported(errno)) {
+            // GSO is not supported by the kernel or the device, send segments one by one
+            gsoSupported.store(false, std::memory_order_relaxed);
+            for (size_t k = 0; k < batch.segmentCount[sent]; k++) {
+                sendDirectly(batch, batch.firstDatagram[sent] + k);
+            }
+        }
+        // otherwise drop the message, as failed sendto() calls would, a full
+        // buffer or a missing route is no reason to give up on GSO
+        sent++;
+    }
+}
+
+void flushBatch(ThreadBatch &batch) {
+    size_t i = 0;
+    while (i < batch.count) {
+        size_t j = i + 1;
+        while (j < batch.count && batch.datagrams[j].fd == batch.datagrams[i].fd &&
+               batch.datagrams[j].flags == batch.datagrams[i].flags) {
+            j++;
+        }
+        sendRun(batch, i, j);
+        i = j;
+    }
+    batch.count = 0;
+}
+
+} // namespace
+
+/// Replaces the libc sendto() for libdatachannel, queueing datagrams while a batch is active
+extern "C" __attribute__((visibility("default")))
+ssize_t sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen) {
+    ThreadBatch *batch = threadBatch.get();
+    if (!batch || !batch->active || !addr || addrlen > sizeof(sockaddr_storage) ||
+        len > UdpSendBatch::maxDatagramSize) {
+        return realSendto()(fd, buf, len, flags, addr, addrlen);
+    }
+    if (batch->count == UdpSendBatch::maxDatagrams) {
+        flushBatch(*batch);
+    }
+    size_t index = batch->count++;
+    Datagram &datagram = batch->datagrams[index];
+    datagram.fd = fd;
+    datagram.flags = flags;
+    datagram.length = len;
+    memcpy(&datagram.address, addr, addrlen);
+    datagram.addressLength = addrlen;
+    memcpy(batch->data[index], buf, len);
+    return ssize_t(len);
+}
+
+void UdpSendBatch::setEnabled(bool value) {
+    enabled.store(value);
+}
+
+bool UdpSendBatch::isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+UdpSendBatch::UdpSendBatch() {
+    if (!isEnabled()) {
+        return;
+    }
+    if (!threadBatch) {
+        threadBatch = std::make_unique<ThreadBatch>();
+    }
+    // nested batches flush with the outermost one
+    if (!threadBatch->active) {
+        threadBatch->active = true;
+        active = true;
+    }
+}
+
+UdpSendBatch::~UdpSendBatch() {
+    if (active) {
+        flush();
+        threadBatch->active = false;
+    }
+}
+
+void UdpSendBatch::flush() {
+    if (active) {
+        flushBatch(*threadBatch);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef udpbatch_hpp
+#define udpbatch_hpp
+
+#include <cstddef>
+
+/// Batches the UDP datagrams sent from the current thread
+///
+/// libdatachannel sends every SRTP packet with its own sendto() call. While a
+/// UdpSendBatch is alive, sendto() calls made on the same thread are queued
+/// instead, and flushed with sendmmsg() when the batch goes out of scope, or
+/// with UDP GSO for runs of equally sized packets to the same peer where the
+/// kernel supports it. Datagrams are reported as sent when queued.
+class UdpSendBatch {
+public:
+    /// Maximum number of queued datagrams before an early flush
+    static const size_t maxDatagrams = 128;
+    /// Largest datagram that is queued, bigger ones are sent directly
+    static const size_t maxDatagramSize = 1500;
+
+    /// Enable or disable batching for all threads, disabled by default
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    /// Starts batching on the current thread if enabled
+    UdpSendBatch();
+    /// Flushes and stops batching on the current thread
+    ~UdpSendBatch();
+
+    /// Sends all queued datagrams
+    void flush();
+
+    UdpSendBatch(const UdpSendBatch &) = delete;
+    UdpSendBatch &operator=(const UdpSendBatch &) = delete;
+
+private:
+    bool active = false;
+};
+
+#endif /* udpbatch_hpp */
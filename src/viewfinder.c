@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "interface/mmal/mmal.h"
 #include "interface/mmal/mmal_logging.h"
 #include "interface/mmal/util/mmal_util.h"
+#include "interface/mmal/util/mmal_util_params.h"
 #include "interface/mmal/util/mmal_default_components.h"
 
 #include "config.h"
@@ -297,13 +298,33 @@ static MMAL_STATUS_T fill_port_from_pool(MMAL_PORT_T *port, MMAL_POOL_T *pool)
 {
    MMAL_STATUS_T status = MMAL_SUCCESS;
    MMAL_QUEUE_T *queue;
+#if MMAL_BUNDLED_CORE
+   MMAL_BUFFER_HEADER_T *buffers[16];
+   unsigned int count, sent;
+#endif
 
    if (!pool)
       return MMAL_SUCCESS;
 
    queue = pool->queue;
+#if MMAL_BUNDLED_CORE
+   // one queue and one port synchronisation per batch instead of per buffer
+   while (status == MMAL_SUCCESS && (count = mmal_queue_get_n(queue, buffers, vcos_countof(buffers))) > 0)
+   {
+      sent = count;
+      status = mmal_port_send_buffers(port, buffers, &sent);
+      if (status != MMAL_SUCCESS)
+      {
+         // put the unsent buffers back in their original order
+         while (count > sent)
+            mmal_queue_put_back(queue, buffers[--count]);
+         LOG_DEBUG("%s send failed (%i)", port->name, status);
+      }
+   }
+#else
    while (status == MMAL_SUCCESS && mmal_queue_length(queue) > 0)
       status = send_buffer_from_queue(port, queue);
+#endif
 
    return status;
 }
@@ -993,6 +1014,7 @@ static MMAL_COMPONENT_T *test_video_encoder_create(MMALCAM_BEHAVIOUR_T *behaviou
 
 /*****************************************************************************/
 MMAL_PORT_T *encoder_input = 0, *encoder_output = 0;
+MMAL_PORT_T *camera_control = 0;
 void request_i_frame() {
     if (mmal_port_parameter_set_boolean(encoder_output, MMAL_PARAMETER_VIDEO_REQUEST_I_FRAME, 1) != MMAL_SUCCESS)
     {
@@ -1000,6 +1022,15 @@ void request_i_frame() {
     }
 }
 
+int get_stc_time(uint64_t *time) {
+    if (!camera_control || mmal_port_parameter_get_uint64(camera_control, MMAL_PARAMETER_SYSTEM_TIME, time) != MMAL_SUCCESS)
+    {
+        vcos_log_error("failed to get system time");
+        return -1;
+    }
+    return 0;
+}
+
 int mmal_start_camcorder(volatile int *stop, MMALCAM_BEHAVIOUR_T *behaviour, on_buffer_cb cb)
 {
    MMAL_STATUS_T status = MMAL_SUCCESS;
@@ -1027,6 +1058,7 @@ int mmal_start_camcorder(volatile int *stop, MMALCAM_BEHAVIOUR_T *behaviour, on_
       goto error;
    }
    video_port = camera->output[1];
+   camera_control = camera->control;
 
    /*...*/
    MMAL_PARAMETER_BOOLEAN_T camera_capture =
@@ -1039,6 +1071,18 @@ int mmal_start_camcorder(volatile int *stop, MMALCAM_BEHAVIOUR_T *behaviour, on_
       behaviour->init_result = MMALCAM_INIT_ERROR_ENCODER;
       goto error;
    }
+
+#if MMAL_BUNDLED_CORE
+   /* Buffer callbacks of both components run on their action threads */
+   if (behaviour->sched_policy != SCHED_OTHER || behaviour->cpus)
+   {
+      if (mmal_component_action_scheduling_set(camera, behaviour->sched_policy,
+                                               behaviour->sched_priority, behaviour->cpus) != MMAL_SUCCESS ||
+          mmal_component_action_scheduling_set(encoder, behaviour->sched_policy,
+                                               behaviour->sched_priority, behaviour->cpus) != MMAL_SUCCESS)
+         LOG_ERROR("couldn't set scheduling of the camera and encoder threads");
+   }
+#endif
    encoder_input = encoder->input[0];
    encoder_output = encoder->output[0];
 
@@ -1189,6 +1233,15 @@ int mmal_start_camcorder(volatile int *stop, MMALCAM_BEHAVIOUR_T *behaviour, on_
       INIT_PARAMETER(behaviour->encoder_stats, MMAL_PARAMETER_STATISTICS);
       mmal_port_parameter_get(encoder_output, &behaviour->encoder_stats.hdr);
    }
+#if MMAL_BUNDLED_CORE
+   /* only the bundled core records latency histograms */
+   mmal_port_latency_get(video_port, &behaviour->camera_latency, MMAL_FALSE);
+   if (encoder)
+   {
+      mmal_port_latency_get(encoder_input, &behaviour->encoder_input_latency, MMAL_FALSE);
+      mmal_port_latency_get(encoder_output, &behaviour->encoder_output_latency, MMAL_FALSE);
+   }
+#endif
 
  error:
    /* The pools need to be destroyed first since they are owned by the components */
@@ -1199,6 +1252,7 @@ int mmal_start_camcorder(volatile int *stop, MMALCAM_BEHAVIOUR_T *behaviour, on_
 
    if(encoder)
       mmal_component_destroy(encoder);
+   camera_control = 0;
    if(camera)
       mmal_component_destroy(camera);
 
@@ -30,8 +30,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include <stdint.h>
+
 void request_i_frame();
 
+/** Read the camera system time clock (STC) used for buffer timestamps.
+ *
+ * @param time Receives the current STC in microseconds.
+ * @return 0 on success, -1 if the camera is not running.
+ */
+int get_stc_time(uint64_t *time);
+
 #ifdef __cplusplus
 }
 #endif
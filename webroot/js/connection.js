@@ -18,11 +18,18 @@ websocket.onmessage = async (evt) => {
     const message = JSON.parse(evt.data);
     if (message.type == "offer") {
         await handleOffer(message)
+    } else if (message.type == "candidate") {
+        await handleCandidate(message);
     }
 }
 
 let pc = null;
+// Reliable channel for configuration and reports
 let dc = null;
+// Unordered channel without retransmissions for control frames
+let controlDc = null;
+// Remote candidates received before the remote description is set
+let pendingCandidates = [];
 
 function createPeerConnection() {
     const config = {
@@ -31,11 +38,30 @@ function createPeerConnection() {
 
     let pc = new RTCPeerConnection(config);
 
+    // Trickle local candidates as they are gathered
+    pc.onicecandidate = (evt) => {
+        if (!evt.candidate || !evt.candidate.candidate) {
+            return;
+        }
+        websocket.send(JSON.stringify({
+            id: clientId,
+            type: "candidate",
+            candidate: evt.candidate.candidate,
+            mid: evt.candidate.sdpMid,
+        }));
+    };
+
     // Receive audio/video track
     pc.ontrack = (evt) => {
         const video = document.getElementById('video');
         // if (!video.srcObject) {
           video.srcObject = evt.streams[0]; // The stream groups audio and video tracks
+        if (evt.track.kind == "audio") {
+            // autoplay requires the video to start muted, unmute on the first user gesture
+            const unmute = () => { video.muted = false; };
+            document.addEventListener('click', unmute, { once: true });
+            document.addEventListener('keydown', unmute, { once: true });
+        }
         //   video.play();
             // document.getElementById('video-text-container').style.display = 'none';
         // }
@@ -43,17 +69,27 @@ function createPeerConnection() {
 
     // Receive data channel
     pc.ondatachannel = (evt) => {
+        if (evt.channel.label == "control") {
+            controlDc = evt.channel;
+            controlDc.binaryType = "arraybuffer";
+            return;
+        }
         dc = evt.channel;
 
         dc.onopen = () => {
             // dataChannelLog.textContent += '- open\n';
             // dataChannelLog.scrollTop = dataChannelLog.scrollHeight;
+            requestLease();
         };
 
         dc.onmessage = (evt) => {
             if (typeof evt.data !== 'string') {
                 return;
             }
+            const message = JSON.parse(evt.data);
+            if (message.lease) {
+                updateLeaseState(message.lease);
+            }
 
             // dataChannelLog.textContent += '< ' + evt.data + '\n';
             // dataChannelLog.scrollTop = dataChannelLog.scrollHeight;
@@ -68,23 +104,8 @@ function createPeerConnection() {
     return pc;
 }
 
-async function waitGatheringComplete() {
-    return new Promise((resolve) => {
-        if (pc.iceGatheringState === 'complete') {
-            resolve();
-        } else {
-            pc.addEventListener('icegatheringstatechange', () => {
-                if (pc.iceGatheringState === 'complete') {
-                    resolve();
-                }
-            });
-        }
-    });
-}
-
 async function sendAnswer(pc) {
     await pc.setLocalDescription(await pc.createAnswer());
-    await waitGatheringComplete();
 
     const answer = pc.localDescription;
     // document.getElementById('answer-sdp').textContent = answer.sdp;
@@ -99,9 +120,34 @@ async function sendAnswer(pc) {
 async function handleOffer(offer) {
     pc = createPeerConnection();
     await pc.setRemoteDescription(offer);
+    // candidates may have arrived while the offer was being applied
+    const candidates = pendingCandidates;
+    pendingCandidates = [];
+    for (const candidate of candidates) {
+        await addCandidate(candidate);
+    }
     await sendAnswer(pc);
 }
 
+async function addCandidate(message) {
+    try {
+        await pc.addIceCandidate({
+            candidate: message.candidate,
+            sdpMid: message.mid,
+        });
+    } catch (e) {
+        console.log("Failed to add candidate: " + e);
+    }
+}
+
+async function handleCandidate(message) {
+    if (!pc || !pc.remoteDescription) {
+        pendingCandidates.push(message);
+        return;
+    }
+    await addCandidate(message);
+}
+
 function sendRequest() {
     websocket.send(JSON.stringify({
         id: clientId,
@@ -121,6 +167,10 @@ function stop() {
         dc.close();
         dc = null;
     }
+    if (controlDc) {
+        controlDc.close();
+        controlDc = null;
+    }
 
     // close transceivers
     if (pc.getTransceivers) {
@@ -146,6 +196,34 @@ function stop() {
     }, 500);
 }
 
+// Report capture to playout latency from the abs-capture-time header extension.
+// Only meaningful when the sender and this device have NTP-synchronized clocks.
+const NTP_EPOCH_OFFSET = 2208988800000; //milliseconds between 1900 and 1970
+const latencyReportInterval = 1000; //milliseconds
+
+function reportLatency() {
+    if (!pc || !dc || dc.readyState != "open") {
+        return;
+    }
+    pc.getReceivers().forEach((receiver) => {
+        if (!receiver.track || receiver.track.kind != "video" || !receiver.getSynchronizationSources) {
+            return;
+        }
+        receiver.getSynchronizationSources().forEach((source) => {
+            if (source.captureTimestamp === undefined) {
+                return;
+            }
+            // timestamp is the playout time of the last frame on the local wall clock
+            const latency = source.timestamp + NTP_EPOCH_OFFSET - source.captureTimestamp;
+            dc.send(JSON.stringify({
+                latency: latency,
+            }));
+        });
+    });
+}
+
+setInterval(reportLatency, latencyReportInterval);
+
 // Helper function to generate a random ID
 function randomId(length) {
   const characters = '0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz';
@@ -30,6 +30,75 @@ let data = {
     y: 1500
 };
 
+// Binary control frames, set to false to send JSON to older servers
+const useBinaryControl = true;
+const CONTROL_FRAME_VERSION = 1;
+const CONTROL_FRAME_HEADER_SIZE = 12;
+let controlSequence = 0;
+
+// Control lease: only the peer holding it drives, the others spectate
+let driving = false;
+const leaseStatus = document.getElementById('lease-status');
+const btnLease = document.getElementById('btn_lease');
+
+function requestLease() {
+    if (dc && (dc.readyState == "open")) {
+        dc.send(JSON.stringify({ lease: "request" }));
+    }
+}
+
+function releaseLease() {
+    if (dc && (dc.readyState == "open")) {
+        dc.send(JSON.stringify({ lease: "release" }));
+    }
+}
+
+function updateLeaseState(lease) {
+    if (lease.driving != driving) {
+        showSnackBar(lease.driving ? "You are driving" : "You are spectating");
+    }
+    driving = lease.driving;
+    if (driving) {
+        leaseStatus.textContent = "Driving";
+        btnLease.textContent = "Release control";
+    } else {
+        leaseStatus.textContent = lease.available ? "Spectating, control is free" : "Spectating";
+        btnLease.textContent = "Take control";
+    }
+}
+
+function showSnackBar(text) {
+    const snackBar = document.getElementById('snackBar');
+    snackBar.textContent = text;
+    snackBar.className = "show";
+    setTimeout(() => { snackBar.className = ""; }, 3000);
+}
+
+btnLease.addEventListener('click', () => {
+    if (driving) {
+        releaseLease();
+    } else {
+        requestLease();
+    }
+});
+
+// Encodes channel values as a little endian binary control frame:
+// version, channel count, reserved, sequence number, sender timestamp (ms), int16 channels
+function encodeControlFrame(channels) {
+    const buffer = new ArrayBuffer(CONTROL_FRAME_HEADER_SIZE + channels.length * 2);
+    const view = new DataView(buffer);
+    view.setUint8(0, CONTROL_FRAME_VERSION);
+    view.setUint8(1, channels.length);
+    view.setUint16(2, 0, true);
+    view.setUint32(4, controlSequence, true);
+    view.setUint32(8, Math.round(performance.now()) >>> 0, true);
+    channels.forEach((value, i) => {
+        view.setInt16(CONTROL_FRAME_HEADER_SIZE + i * 2, value, true);
+    });
+    controlSequence = (controlSequence + 1) >>> 0;
+    return buffer;
+}
+
 let dataX = 1500;
 let dataY = 1500;
 let previousTime;
@@ -53,10 +122,15 @@ function loop(timeStamp = 0) {
 
     if (timerSendDC >= sendDCInterval) {
         timerSendDC = 0;
-        if (dc && (dc.readyState == "open")) {
+        // control frames double as the lease heartbeat
+        if (driving && controlDc && (controlDc.readyState == "open")) {
             data.x = Math.round(dataX);
             data.y = Math.round(dataY);
-            dc.send(JSON.stringify(data));
+            if (useBinaryControl) {
+                controlDc.send(encodeControlFrame([data.x, data.y]));
+            } else {
+                controlDc.send(JSON.stringify(data));
+            }
         }
     }
 